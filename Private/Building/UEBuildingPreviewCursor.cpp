@@ -5,6 +5,7 @@
 #include "Components/InputComponent.h"
 #include "Engine/OverlapResult.h"
 #include "EnhancedInputComponent.h"
+#include "Grid/UEGridLibrary.h"
 #include "Grid/UEGridPlacementComponent.h"
 #include "Grid/UEGridSystem.h"
 #include "InputAction.h"
@@ -17,10 +18,12 @@ AUEBuildingPreviewCursor::AUEBuildingPreviewCursor()
 	PreviewMesh->SetupAttachment(GridPlacement, UUEGridPlacementComponent::GridCenterSocketName);
 	PreviewMesh->SetMobility(EComponentMobility::Type::Movable);
 	PreviewMesh->SetCollisionProfileName("OverlapAllDynamic");
+	bCanBePlaced = false;
 	BuildingPreviewCursorInputMappingContext = nullptr;
 	TryToPlaceBuildingInputAction = nullptr;
 	RotateClockwiseInputAction = nullptr;
 	RotateCounterclockwiseInputAction = nullptr;
+	FreeRectsMapMargin = 64;
 }
 
 void AUEBuildingPreviewCursor::BeginPlay()
@@ -30,12 +33,21 @@ void AUEBuildingPreviewCursor::BeginPlay()
 	PreviousPreviewRotation = GetPreviewRotation();
 	TArray<FOverlapResult> NewOverlaps = GetFoliageOverlaps(PreviousPreviewLocation, PreviousPreviewRotation);
 	HideAndShowOverlappedFoliage(TArray<FOverlapResult>(), NewOverlaps);
+	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	{
+		OnGridChangedHandle = GridSystem->OnGridChanged.AddUObject(this, &AUEBuildingPreviewCursor::OnGridChanged);
+	}
 }
 
 void AUEBuildingPreviewCursor::EndPlay(EEndPlayReason::Type const EndPlayReason)
 {
 	TArray<FOverlapResult> OldOverlaps = GetFoliageOverlaps(PreviousPreviewLocation, PreviousPreviewRotation);
 	HideAndShowOverlappedFoliage(OldOverlaps, TArray<FOverlapResult>());
+	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	{
+		GridSystem->OnGridChanged.Remove(OnGridChangedHandle);
+	}
+	OnGridChangedHandle.Reset();
 
 	Super::EndPlay(EndPlayReason);
 }
@@ -77,6 +89,7 @@ void AUEBuildingPreviewCursor::SetupFor(TSubclassOf<AUEBuildingActor> const Buil
 			GridPlacement->SetGridSize(CDOUEGridPlacementComponent->GetGridSize());
 		}
 	}
+	UpdateCanBePlaced();
 }
 
 bool AUEBuildingPreviewCursor::IsCursorSetup() const
@@ -100,6 +113,15 @@ void AUEBuildingPreviewCursor::OnPreviewChanged()
 	TArray<FOverlapResult> OldOverlaps = GetFoliageOverlaps(PreviousPreviewLocation, PreviousPreviewRotation);
 	TArray<FOverlapResult> NewOverlaps = GetFoliageOverlaps(GetPreviewLocation(), GetPreviewRotation());
 	HideAndShowOverlappedFoliage(OldOverlaps, NewOverlaps);
+	UpdateCanBePlaced();
+}
+
+void AUEBuildingPreviewCursor::OnGridChanged(FUEGridChanges const & GridChanges)
+{
+	if (IsCursorSetup())
+	{
+		UpdateCanBePlaced();
+	}
 }
 
 void AUEBuildingPreviewCursor::SetupPlayerInputComponent(UInputComponent * PlayerInputComponent)
@@ -130,6 +152,11 @@ void AUEBuildingPreviewCursor::TryToPlaceBuilding()
 		FActorSpawnParameters SpawnParameters;
 		SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
 		World->SpawnActor<AUEGridPlacedActor>(PreviewBuildingClass, GetTransform(), SpawnParameters);
+		// Cells of the building are published right away, so that OnGridChanged updates bCanBePlaced.
+		if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+		{
+			GridSystem->BroadcastGridChanges();
+		}
 	}
 }
 
@@ -161,4 +188,16 @@ void AUEBuildingPreviewCursor::RotateCounterclockwise()
 	}
 
 	RotateAndGridSnap(-90.);
+}
+
+void AUEBuildingPreviewCursor::UpdateCanBePlaced()
+{
+	check(IsValid(GridPlacement));
+	FIntRect const GridRect{ GridPlacement->GetGridRect(GridPlacement->GetLocationOnGrid()) };
+	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	{
+		EUEGridLayer const GridLayersToCheck[] = { GridPlacement->GetLayerToRegisterOn(), EUEGridLayer::NatureObstacle };
+		GridSystem->UpdateFreeRectsMap(GridLayersToCheck, GridRect.Size(), GridRect, FreeRectsMapMargin, FreeRectsMap);
+	}
+	bCanBePlaced = IsCursorSetup() && FreeRectsMap.IsFree(GridRect.Min, GridRect.Size());
 }
\ No newline at end of file
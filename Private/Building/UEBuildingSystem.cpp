@@ -1,9 +1,23 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "Building/UEBuildingSystem.h"
+#include "Async/Async.h"
+#include "Common/UELog.h"
 #include "Grid/UEConcurrentSpatialGridIndex.h"
 
-UUEBuildingSystem::UUEBuildingSystem() = default;
+namespace
+{
+	FIntPoint const DefaultChunkSize = { 256, 256 };
+	FIntPoint const DefaultIndexCellSize = { 16, 16 };
+	FIntPoint const DefaultLockCellSize = { 64, 64 };
+}
+
+UUEBuildingSystem::UUEBuildingSystem()
+	: ChunkSize(DefaultChunkSize)
+	, IndexCellSize(DefaultIndexCellSize)
+	, LockCellSize(DefaultLockCellSize)
+{
+}
 
 UUEBuildingSystem::UUEBuildingSystem(FVTableHelper & Helper)
 {
@@ -15,11 +29,18 @@ void UUEBuildingSystem::Initialize(FSubsystemCollectionBase & Collection)
 {
 	Super::Initialize(Collection);
 
-	// TODO : Create config.
-	FIntPoint const IndexSize = { 1024, 1024 };
-	FIntPoint const IndexCellSize = { 16, 16 };
-	FIntPoint const LockCellSize = { 64, 64 };
-	SpatialGridIndex.Reset(new TUEConcurrentSpatialGridIndex<TObjectPtr<AActor>>(IndexSize, IndexCellSize, LockCellSize));
+	bool const bAreSizesValid = IndexCellSize.GetMin() > 0 && LockCellSize.GetMin() > 0 && ChunkSize.GetMin() > 0
+		&& LockCellSize.X % IndexCellSize.X == 0 && LockCellSize.Y % IndexCellSize.Y == 0
+		&& ChunkSize.X % LockCellSize.X == 0 && ChunkSize.Y % LockCellSize.Y == 0;
+	if (!bAreSizesValid)
+	{
+		UE_LOGFMT(LogUE, Error, "Spatial index sizes {0} {1} {2} from config don't divide each other, defaults are used.",
+			ChunkSize.ToString(), IndexCellSize.ToString(), LockCellSize.ToString());
+		ChunkSize = DefaultChunkSize;
+		IndexCellSize = DefaultIndexCellSize;
+		LockCellSize = DefaultLockCellSize;
+	}
+	SpatialGridIndex.Reset(new TUEConcurrentSpatialGridIndex<TObjectPtr<AActor>>(ChunkSize, IndexCellSize, LockCellSize));
 	TaskPipe.Reset(new UE::Tasks::FPipe(UE_SOURCE_LOCATION));
 }
 
@@ -27,6 +48,7 @@ void UUEBuildingSystem::Deinitialize()
 {
 	if (TaskPipe)
 	{
+		LaunchAddingBuildings();
 		TaskPipe->WaitUntilEmpty();
 	}
 	TaskPipe.Reset();
@@ -35,26 +57,36 @@ void UUEBuildingSystem::Deinitialize()
 	Super::Deinitialize();
 }
 
-FIntPoint UUEBuildingSystem::GetIndexOriginCoords() const
-{
-	FIntPoint const GridIndexSize = GetIndexSize();
-	return GridIndexSize != FIntPoint{ 0, 0 } ? GridIndexSize / -2 : FIntPoint{ 0, 0 };
-}
-
-FIntPoint UUEBuildingSystem::GetIndexSize() const
+void UUEBuildingSystem::AddBuildingAsync(TObjectPtr<AActor> const BuildingPtr, FIntRect const & BuildingRect)
 {
-	return SpatialGridIndex ? SpatialGridIndex->GetSize() : FIntPoint{ 0, 0 };
+	check(IsInGameThread());
+	if (TaskPipe)
+	{
+		if (BuildingsToAdd.IsEmpty())
+		{
+			AsyncTask(ENamedThreads::GameThread, [WeakThis = TWeakObjectPtr<UUEBuildingSystem>{ this }]()
+				{
+					if (WeakThis.IsValid())
+					{
+						WeakThis->LaunchAddingBuildings();
+					}
+				});
+		}
+		BuildingsToAdd.Emplace(BuildingRect, BuildingPtr);
+	}
 }
 
-void UUEBuildingSystem::AddBuildingAsync(TObjectPtr<AActor> const BuildingPtr, FIntRect const & BuildingRect)
+void UUEBuildingSystem::LaunchAddingBuildings()
 {
-	if (TaskPipe)
+	check(IsInGameThread());
+	if (TaskPipe && !BuildingsToAdd.IsEmpty())
 	{
 		TaskPipe->Launch(UE_SOURCE_LOCATION,
-			[this, BuildingPtr, BuildingRect]()
+			[this, Buildings = MoveTemp(BuildingsToAdd)]()
 			{
-				AddBuilding(BuildingPtr, BuildingRect);
+				AddBuildings(Buildings);
 			});
+		BuildingsToAdd.Reset();
 	}
 }
 
@@ -62,6 +94,7 @@ void UUEBuildingSystem::RemoveOverlappedBuildingsAsync(FIntRect const & RectToCh
 {
 	if (TaskPipe)
 	{
+		LaunchAddingBuildings();
 		TaskPipe->Launch(UE_SOURCE_LOCATION,
 			[this, RectToCheckForOverlap]()
 			{
@@ -74,6 +107,7 @@ void UUEBuildingSystem::RemoveOverlappedBuildingsAsync(FIntRect const & RectToCh
 {
 	if (TaskPipe)
 	{
+		LaunchAddingBuildings();
 		TaskPipe->Launch(UE_SOURCE_LOCATION,
 			[this, RectToCheckForOverlap, BuildingPtr]()
 			{
@@ -86,16 +120,26 @@ bool UUEBuildingSystem::AddBuilding(TObjectPtr<AActor> const BuildingPtr, FIntRe
 {
 	if (SpatialGridIndex)
 	{
-		return SpatialGridIndex->TryInsert(BuildingRect - GetIndexOriginCoords(), BuildingPtr);
+		return SpatialGridIndex->TryInsert(BuildingRect, BuildingPtr);
 	}
 	return false;
 }
 
+TBitArray<> UUEBuildingSystem::AddBuildings(TConstArrayView<TPair<FIntRect, TObjectPtr<AActor>>> const Buildings)
+{
+	TBitArray<> Results;
+	if (SpatialGridIndex)
+	{
+		SpatialGridIndex->TryInsertBatch(Buildings, Results);
+	}
+	return Results;
+}
+
 void UUEBuildingSystem::RemoveOverlappedBuildings(FIntRect const & RectToCheckForOverlap)
 {
 	if (SpatialGridIndex)
 	{
-		SpatialGridIndex->Erase(RectToCheckForOverlap - GetIndexOriginCoords());
+		SpatialGridIndex->Erase(RectToCheckForOverlap);
 	}
 }
 
@@ -103,7 +147,7 @@ void UUEBuildingSystem::RemoveOverlappedBuildings(FIntRect const & RectToCheckFo
 {
 	if (SpatialGridIndex)
 	{
-		SpatialGridIndex->EraseByPredicate(RectToCheckForOverlap - GetIndexOriginCoords(), [BuildingPtr](TPair<FIntRect, TObjectPtr<AActor>> const & IndexEntry) -> bool
+		SpatialGridIndex->EraseByPredicate(RectToCheckForOverlap, [BuildingPtr](TPair<FIntRect, TObjectPtr<AActor>> const & IndexEntry) -> bool
 			{
 				return IndexEntry.Value == BuildingPtr;
 			});
@@ -115,7 +159,7 @@ TArray<TObjectPtr<AActor>> UUEBuildingSystem::GetOverlappedBuildings(FIntRect co
 	TArray<TObjectPtr<AActor>> Buildings;
 	if (SpatialGridIndex)
 	{
-		SpatialGridIndex->GetOverlapping(RectToCheckForOverlap - GetIndexOriginCoords()).GenerateValueArray(Buildings);
+		SpatialGridIndex->GetOverlapping(RectToCheckForOverlap, Buildings);
 	}
 	return Buildings;
 }
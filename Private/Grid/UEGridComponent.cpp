@@ -1,23 +1,99 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "Grid/UEGridComponent.h"
+#include "Async/ParallelFor.h"
 #include "Common/UELog.h"
+#include "EngineUtils.h"
 #include "Grid/UEGridLayer.h"
 #include "Grid/UEGridLibrary.h"
 #include "Grid/UEGridSystem.h"
+#include "HAL/IConsoleManager.h"
+#include "LandscapeHeightfieldCollisionComponent.h"
+#include "LandscapeProxy.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/ObjectSaveContext.h"
+
+namespace
+{
+	/** Increase to invalidate baked nature obstacle layers after changes of obstacles calculation. */
+	constexpr uint32 NatureObstacleLayerBakeVersion = 2;
+	/** Number of probe traces along each axis for nature obstacle layer hash, catching changes of geometry other than landscape. */
+	constexpr int32 NatureObstacleLayerHashProbesPerAxisNum = 17;
+
+	/** Grid layers paths are placed on. Each of them has a layer of cells blocked for such paths. */
+	constexpr EUEGridLayer PathGridLayers[] = { EUEGridLayer::Road };
+
+	int32 GetPathGridLayerIndex(EUEGridLayer const GridLayer)
+	{
+		return MakeArrayView(PathGridLayers).Find(GridLayer);
+	}
+
+	TAutoConsoleVariable<int32> CVarNatureObstacleLayerFillMode(
+		TEXT("UE.Grid.NatureObstacleLayerFillMode"),
+		1,
+		TEXT("How nature obstacle layer is traced when there is no valid bake.\n")
+		TEXT("0: serially on game thread.\n")
+		TEXT("1: in parallel.\n")
+		TEXT("2: in parallel, then serially to validate result and compare timings."),
+		ECVF_Default);
+
+	/** Checks if cell is nature obstacle by heights of its corners. */
+	bool IsNatureObstacleCell(float const MinXMinYZ, float const MinXMaxYZ, float const MaxXMinYZ, float const MaxXMaxYZ, float const GroundTraceHalfLength, float const ObstacleCellCornerZMinDifferenceFromMean)
+	{
+		// Order of summation is a part of the result, vectorized version must keep it.
+		float const Mean = (MaxXMaxYZ + MaxXMinYZ + MinXMaxYZ + MinXMinYZ) / 4.f;
+		return FMath::IsNearlyEqual(Mean, -GroundTraceHalfLength)
+			|| Mean - MaxXMaxYZ > ObstacleCellCornerZMinDifferenceFromMean
+			|| Mean - MaxXMinYZ > ObstacleCellCornerZMinDifferenceFromMean
+			|| Mean - MinXMaxYZ > ObstacleCellCornerZMinDifferenceFromMean
+			|| Mean - MinXMinYZ > ObstacleCellCornerZMinDifferenceFromMean;
+	}
+
+	/**
+	 * Vectorized IsNatureObstacleCell for 4 cells along Y.
+	 * @param MinXZs, MaxXZs - heights of corners of cells column along Y at min and max X.
+	 * @return bit per cell.
+	 */
+	uint32 GetNatureObstacleCellsBits(float const * const MinXZs, float const * const MaxXZs, VectorRegister4Float const NoHitZ, VectorRegister4Float const ObstacleCellCornerZMinDifferenceFromMean)
+	{
+		VectorRegister4Float const MinXMinYZ = VectorLoad(MinXZs);
+		VectorRegister4Float const MinXMaxYZ = VectorLoad(MinXZs + 1);
+		VectorRegister4Float const MaxXMinYZ = VectorLoad(MaxXZs);
+		VectorRegister4Float const MaxXMaxYZ = VectorLoad(MaxXZs + 1);
+		VectorRegister4Float const Mean = VectorDivide(VectorAdd(VectorAdd(VectorAdd(MaxXMaxYZ, MaxXMinYZ), MinXMaxYZ), MinXMinYZ), VectorSetFloat1(4.f));
+		VectorRegister4Float IsObstacle = VectorCompareLE(VectorAbs(VectorSubtract(Mean, NoHitZ)), VectorSetFloat1(UE_SMALL_NUMBER));
+		IsObstacle = VectorBitwiseOr(IsObstacle, VectorCompareGT(VectorSubtract(Mean, MaxXMaxYZ), ObstacleCellCornerZMinDifferenceFromMean));
+		IsObstacle = VectorBitwiseOr(IsObstacle, VectorCompareGT(VectorSubtract(Mean, MaxXMinYZ), ObstacleCellCornerZMinDifferenceFromMean));
+		IsObstacle = VectorBitwiseOr(IsObstacle, VectorCompareGT(VectorSubtract(Mean, MinXMaxYZ), ObstacleCellCornerZMinDifferenceFromMean));
+		IsObstacle = VectorBitwiseOr(IsObstacle, VectorCompareGT(VectorSubtract(Mean, MinXMinYZ), ObstacleCellCornerZMinDifferenceFromMean));
+		return static_cast<uint32>(VectorMaskBits(IsObstacle));
+	}
+} // namespace
 
 UUEGridComponent::UUEGridComponent()
 {
 	ObstacleCellCornerZMinDifferenceFromMean = 30.f;
 	GroundTraceHalfLength = 9e4f;
 	GroundTraceChannel = ECollisionChannel::ECC_WorldStatic;
+	SparseGridLayers = { EUEGridLayer::Construction, EUEGridLayer::Road };
+	BakedNatureObstacleLayerUncompressedSize = 0;
+	BakedNatureObstacleLayerHash = 0;
+	bStreamGridLayers = false;
+	bIsStreamingInGridLayers = false;
+	bAreGridLayersStreamedIn = false;
+	RegistrationSerial = 0;
 }
 
 void UUEGridComponent::BeginPlay()
 {
 	Super::BeginPlay();
 
-	FillNatureObstacleLayer();
+	if (!bAreGridLayersStreamedIn && !LoadBakedNatureObstacleLayer())
+	{
+		FillNatureObstacleLayer();
+	}
 }
 
 void UUEGridComponent::OnRegister()
@@ -35,17 +111,41 @@ void UUEGridComponent::OnRegister()
 	GridRect = FIntRect{ GridOrigin, GridOrigin + GridSize };
 	for (EUEGridLayer const GridLayer : TEnumRange<EUEGridLayer>{})
 	{
-		GridLayers.Emplace(static_cast<FUintPoint>(GridSize));
+		FUEGridLayer::EStorage const Storage = SparseGridLayers.Contains(GridLayer) ? FUEGridLayer::EStorage::Sparse : FUEGridLayer::EStorage::Dense;
+		GridLayers.Emplace(static_cast<FUintPoint>(GridSize), Storage);
 	}
-
-	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	for (EUEGridLayer const PathGridLayer : PathGridLayers)
 	{
-		GridSystem->RegisterGridComponent(this);
+		// Blocked cells mostly come from nature obstacles, so they are stored in the same way.
+		PathBlockingLayers.Emplace(static_cast<FUintPoint>(GridSize), GetLayer(EUEGridLayer::NatureObstacle).GetStorage());
 	}
-	else
+
+	UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this);
+	if (UNLIKELY(!GridSystem))
 	{
 		UE_LOGFMT(LogUE, Warning, "No UUEGridSystem found in world, UUEGridComponent \"{0}\" cannot be registered.", GetName());
+		return;
+	}
+	if (ShouldStreamGridLayers())
+	{
+		bool const bIsStreamingIn = GridSystem->StreamInGridLayers(GridRect, [WeakThis = TWeakObjectPtr<UUEGridComponent>{ this }, Serial = RegistrationSerial](TArray<FUEGridLayer> && StreamedInGridLayers)
+			{
+				UUEGridComponent * const This = WeakThis.Get();
+				if (!This || This->RegistrationSerial != Serial)
+				{
+					return false;
+				}
+				This->FinishStreamingInGridLayers(MoveTemp(StreamedInGridLayers));
+				return true;
+			});
+		if (bIsStreamingIn)
+		{
+			bIsStreamingInGridLayers = true;
+			bAreGridLayersStreamedIn = true;
+			return;
+		}
 	}
+	GridSystem->RegisterGridComponent(this);
 }
 
 void UUEGridComponent::OnUnregister()
@@ -53,9 +153,18 @@ void UUEGridComponent::OnUnregister()
 	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
 	{
 		GridSystem->UnregisterGridComponent(this);
+		// Layers still being streamed in stay kept in grid system.
+		if (ShouldStreamGridLayers() && !bIsStreamingInGridLayers && !GridLayers.IsEmpty())
+		{
+			GridSystem->StreamOutGridLayers(GridRect, MoveTemp(GridLayers));
+		}
 	}
+	++RegistrationSerial;
+	bIsStreamingInGridLayers = false;
+	bAreGridLayersStreamedIn = false;
 
 	GridLayers.Empty();
+	PathBlockingLayers.Empty();
 	GridRect = FIntRect{};
 
 	Super::OnUnregister();
@@ -66,6 +175,21 @@ FBoxSphereBounds UUEGridComponent::CalcBounds(FTransform const & LocalToWorld) c
 	return FBoxSphereBounds{ FBox{ FVector{ 0.f, 0.f, 0.f }, FVector{ 1.f, 1.f, 1.f } } }.TransformBy(LocalToWorld);
 }
 
+void UUEGridComponent::GetResourceSizeEx(FResourceSizeEx & CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(GridLayers.GetAllocatedSize() + PathBlockingLayers.GetAllocatedSize());
+	for (FUEGridLayer const & GridLayer : GridLayers)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(GridLayer.GetAllocatedSize());
+	}
+	for (FUEGridLayer const & PathBlockingLayer : PathBlockingLayers)
+	{
+		CumulativeResourceSize.AddDedicatedSystemMemoryBytes(PathBlockingLayer.GetAllocatedSize());
+	}
+}
+
 FIntPoint UUEGridComponent::GetGridSize() const
 {
 	return GridRect.Size();
@@ -95,6 +219,34 @@ bool UUEGridComponent::IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint co
 	return GetLayer(GridLayer)[GetUnsignedCellCoordsUnsafe(CellCoords)];
 }
 
+void UUEGridComponent::IsCellsOccupied(EUEGridLayer const GridLayer, TConstArrayView<FIntPoint> const CellsCoords, TBitArray<> & OutIsOccupied) const
+{
+	FUEGridLayer const & Layer = GetLayer(GridLayer);
+	for (FIntPoint const CellCoords : CellsCoords)
+	{
+		OutIsOccupied.Add(IsInGrid(CellCoords) && Layer[GetUnsignedCellCoordsUnsafe(CellCoords)]);
+	}
+}
+
+void UUEGridComponent::ExtractRectMask(EUEGridLayer const GridLayer, FIntRect const & MaskRect, TBitArray<> & OutMask) const
+{
+	check(OutMask.Num() == MaskRect.Area());
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(MaskRect);
+	if (ClippedRect.IsEmpty())
+	{
+		return;
+	}
+	bool const bValue = true;
+	int32 const MaskWidth = MaskRect.Width();
+	FIntPoint const GridToMaskShift = GridRect.Min - MaskRect.Min;
+	GetLayer(GridLayer).ForEachCell(GetUnsignedRectUnsafe(ClippedRect), bValue, [&OutMask, MaskWidth, GridToMaskShift](FUintPoint const CellCoords)
+		{
+			FIntPoint const MaskCoords = FIntPoint{ CellCoords } + GridToMaskShift;
+			OutMask[MaskCoords.Y * MaskWidth + MaskCoords.X] = true;
+		});
+}
+
 bool UUEGridComponent::SetCellState(EUEGridLayer const GridLayer, FVector2D const Coords, bool const bIsOccupied)
 {
 	return SetCellState(GridLayer, UUEGridLibrary::GetGridCellCoords(this, Coords), bIsOccupied);
@@ -107,9 +259,24 @@ bool UUEGridComponent::SetCellState(EUEGridLayer const GridLayer, FIntPoint cons
 		return false;
 	}
 	GetLayer(GridLayer)[GetUnsignedCellCoordsUnsafe(CellCoords)] = bIsOccupied;
+	UpdatePathBlockingLayers(GridLayer, FIntRect{ CellCoords, CellCoords + FIntPoint{ 1, 1 } });
 	return true;
 }
 
+bool UUEGridComponent::IsCellBlockedForPath(EUEGridLayer const PathGridLayer, FIntPoint const CellCoords) const
+{
+	if (!IsInGrid(CellCoords))
+	{
+		return false;
+	}
+	FUintPoint const UnsignedCellCoords = GetUnsignedCellCoordsUnsafe(CellCoords);
+	if (int32 const PathGridLayerIndex = GetPathGridLayerIndex(PathGridLayer); PathGridLayerIndex != INDEX_NONE)
+	{
+		return PathBlockingLayers[PathGridLayerIndex][UnsignedCellCoords];
+	}
+	return GetLayer(EUEGridLayer::NatureObstacle)[UnsignedCellCoords] || (GetLayer(EUEGridLayer::Construction)[UnsignedCellCoords] && !GetLayer(PathGridLayer)[UnsignedCellCoords]);
+}
+
 bool UUEGridComponent::HasOccupiedCell(EUEGridLayer const GridLayer, FBox2D const & Rect) const
 {
 	return HasOccupiedCell(GridLayer, UUEGridLibrary::GetGridIntRect(this, Rect));
@@ -133,10 +300,205 @@ void UUEGridComponent::SetCellsState(EUEGridLayer const GridLayer, FIntRect cons
 	FIntRect ClippedRect = GetGridRect();
 	ClippedRect.Clip(Rect);
 	GetLayer(GridLayer).SetCells(GetUnsignedRectUnsafe(ClippedRect), bIsOccupied);
+	UpdatePathBlockingLayers(GridLayer, ClippedRect);
 }
 
+int64 UUEGridComponent::CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const
+{
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	bool const bValue = true;
+	return GetLayer(GridLayer).CountCells(GetUnsignedRectUnsafe(ClippedRect), bValue);
+}
+
+void UUEGridComponent::ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const
+{
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	bool const bValue = true;
+	GetLayer(GridLayer).ForEachCell(GetUnsignedRectUnsafe(ClippedRect), bValue, [this, &Visitor](FUintPoint const CellCoords)
+		{
+			Visitor(FIntPoint{ CellCoords } + GridRect.Min);
+		});
+}
+
+void UUEGridComponent::GetChangedRects(EUEGridLayer const GridLayer, uint64 const SinceGeneration, TArray<FIntRect> & OutRects) const
+{
+	TArray<FUintRect> ChangedRects;
+	GetLayer(GridLayer).GetChangedRects(SinceGeneration, ChangedRects);
+	for (FUintRect const & ChangedRect : ChangedRects)
+	{
+		// Layer is rounded up to whole tiles, so its rectangles may stick out of grid.
+		FIntRect Rect{ FIntPoint{ ChangedRect.Min } + GridRect.Min, FIntPoint{ ChangedRect.Max } + GridRect.Min };
+		Rect.Clip(GridRect);
+		if (!Rect.IsEmpty())
+		{
+			OutRects.Emplace(Rect);
+		}
+	}
+}
+
+void UUEGridComponent::UpdateLayersCopy(TArray<FUEGridLayer> & InOutLayersCopy, uint64 const SinceGeneration) const
+{
+	if (InOutLayersCopy.Num() != GridLayers.Num())
+	{
+		InOutLayersCopy = GridLayers;
+		return;
+	}
+	for (int32 LayerIndex = 0; LayerIndex < GridLayers.Num(); ++LayerIndex)
+	{
+		InOutLayersCopy[LayerIndex].CopyChangedTiles(GridLayers[LayerIndex], SinceGeneration);
+	}
+}
+
+void UUEGridComponent::CombineLayers(EUEGridLayer const DestinationGridLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect)
+{
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	GetLayer(DestinationGridLayer).Combine(GetLayer(SourceGridLayerA), GetLayer(SourceGridLayerB), Operation, GetUnsignedRectUnsafe(ClippedRect));
+	UpdatePathBlockingLayers(DestinationGridLayer, ClippedRect);
+}
+
+FUEGridLayer UUEGridComponent::CreateScratchLayer() const
+{
+	return FUEGridLayer{ static_cast<FUintPoint>(GetGridSize()), FUEGridLayer::EStorage::Sparse };
+}
+
+void UUEGridComponent::CombineLayers(FUEGridLayer & ScratchLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect) const
+{
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	ScratchLayer.Combine(GetLayer(SourceGridLayerA), GetLayer(SourceGridLayerB), Operation, GetUnsignedRectUnsafe(ClippedRect));
+}
+
+void UUEGridComponent::FindFreeRects(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, TArray<FIntPoint> & OutAnchors) const
+{
+	if (Size.X <= 0 || Size.Y <= 0)
+	{
+		return;
+	}
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	TArray<FUintPoint> Anchors;
+	FUEGridLayer::FindFreeRects(GetLayers(GridLayersToCheck), GetUnsignedRectUnsafe(ClippedRect), static_cast<FUintPoint>(Size), Anchors);
+	OutAnchors.Reserve(OutAnchors.Num() + Anchors.Num());
+	for (FUintPoint const Anchor : Anchors)
+	{
+		OutAnchors.Emplace(FIntPoint{ Anchor } + GridRect.Min);
+	}
+}
+
+bool UUEGridComponent::FindNearestFreeRect(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, FIntPoint const DesiredAnchor, FIntPoint & OutAnchor) const
+{
+	if (Size.X <= 0 || Size.Y <= 0)
+	{
+		return false;
+	}
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	FUintPoint Anchor;
+	if (!FUEGridLayer::FindNearestFreeRect(GetLayers(GridLayersToCheck), GetUnsignedRectUnsafe(ClippedRect), static_cast<FUintPoint>(Size), DesiredAnchor - GridRect.Min, Anchor))
+	{
+		return false;
+	}
+	OutAnchor = FIntPoint{ Anchor } + GridRect.Min;
+	return true;
+}
+
+#if WITH_EDITOR
+void UUEGridComponent::BakeNatureObstacleLayer()
+{
+	UWorld const * const World = GetWorld();
+	if (UNLIKELY(!World) || GridLayers.Num() != static_cast<uint8>(EUEGridLayer::LAYERS_NUM))
+	{
+		UE_LOGFMT(LogUE, Warning, "UUEGridComponent \"{0}\" is not registered, nature obstacle layer cannot be baked.", GetName());
+		return;
+	}
+
+	bool const bIsOccupied = false;
+	SetCellsState(EUEGridLayer::NatureObstacle, GridRect, bIsOccupied);
+	FillNatureObstacleLayer();
+
+	TArray<uint8> SerializedLayer;
+	FMemoryWriter Writer{ SerializedLayer };
+	GetLayer(EUEGridLayer::NatureObstacle).Serialize(Writer);
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, SerializedLayer.Num());
+	TArray<uint8> CompressedLayer;
+	CompressedLayer.SetNumUninitialized(CompressedSize);
+	if (!FCompression::CompressMemory(NAME_Oodle, CompressedLayer.GetData(), CompressedSize, SerializedLayer.GetData(), SerializedLayer.Num()))
+	{
+		UE_LOGFMT(LogUE, Warning, "Compression of nature obstacle layer of UUEGridComponent \"{0}\" failed.", GetName());
+		return;
+	}
+	CompressedLayer.SetNum(CompressedSize);
+
+	Modify();
+	BakedNatureObstacleLayer = MoveTemp(CompressedLayer);
+	BakedNatureObstacleLayerUncompressedSize = SerializedLayer.Num();
+	BakedNatureObstacleLayerHash = CalculateNatureObstacleLayerHash(World);
+	UE_LOGFMT(LogUE, Log, "Nature obstacle layer of UUEGridComponent \"{0}\" baked into {1} bytes.", GetName(), CompressedSize);
+}
+
+void UUEGridComponent::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+
+	UWorld const * const World = GetWorld();
+	if (!SaveContext.IsProceduralSave() && !BakedNatureObstacleLayer.IsEmpty() && World && !HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject)
+		&& CalculateNatureObstacleLayerHash(World) != BakedNatureObstacleLayerHash)
+	{
+		UE_LOGFMT(LogUE, Warning, "Baked nature obstacle layer of UUEGridComponent \"{0}\" is outdated, it will be traced on BeginPlay. Bake it again.", GetName());
+	}
+}
+#endif
+
 void UUEGridComponent::FillNatureObstacleLayer()
 {
+	switch (CVarNatureObstacleLayerFillMode.GetValueOnGameThread())
+	{
+		case 0:
+		{
+			FillNatureObstacleLayerSerially();
+			break;
+		}
+		case 2:
+		{
+			double const ParallelStartTime = FPlatformTime::Seconds();
+			FillNatureObstacleLayerInParallel();
+			double const ParallelDuration = FPlatformTime::Seconds() - ParallelStartTime;
+			FUEGridLayer ParallelLayer = GetLayer(EUEGridLayer::NatureObstacle);
+
+			bool const bIsOccupied = false;
+			SetCellsState(EUEGridLayer::NatureObstacle, GridRect, bIsOccupied);
+			double const SerialStartTime = FPlatformTime::Seconds();
+			FillNatureObstacleLayerSerially();
+			double const SerialDuration = FPlatformTime::Seconds() - SerialStartTime;
+
+			TArray<uint8> ParallelData;
+			FMemoryWriter ParallelWriter{ ParallelData };
+			ParallelLayer.Serialize(ParallelWriter);
+			TArray<uint8> SerialData;
+			FMemoryWriter SerialWriter{ SerialData };
+			GetLayer(EUEGridLayer::NatureObstacle).Serialize(SerialWriter);
+			if (ParallelData != SerialData)
+			{
+				UE_LOGFMT(LogUE, Error, "Nature obstacle layer of UUEGridComponent \"{0}\" filled in parallel differs from serial one.", GetName());
+			}
+			UE_LOGFMT(LogUE, Log, "Nature obstacle layer of UUEGridComponent \"{0}\" {1}x{2} filled in parallel in {3} ms, serially in {4} ms.",
+				GetName(), GridRect.Width(), GridRect.Height(), ParallelDuration * 1000., SerialDuration * 1000.);
+			break;
+		}
+		default:
+		{
+			FillNatureObstacleLayerInParallel();
+		}
+	}
+	UpdatePathBlockingLayers(EUEGridLayer::NatureObstacle, GridRect);
+}
+
+void UUEGridComponent::FillNatureObstacleLayerSerially()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridComponent::FillNatureObstacleLayerSerially);
 	check(GridLayers.Num() == static_cast<uint8>(EUEGridLayer::LAYERS_NUM));
 	UWorld const * const World = GetWorld();
 	if (UNLIKELY(!World) || GridRect.IsEmpty())
@@ -158,12 +520,7 @@ void UUEGridComponent::FillNatureObstacleLayer()
 			FIntPoint const CurrentCellCoords{ X, Y };
 			float const CurrentYZ = GetGridCellCornerZUnsafe(CurrentCellCoords, World, GridCellSize);
 			int32 const CurrentIndex = Y - GridRect.Min.Y;
-			float const Mean = (CurrentYZ + PreviousYZ + PreviousXZs[CurrentIndex] + PreviousXZs[CurrentIndex - 1]) / 4.f;
-			if (FMath::IsNearlyEqual(Mean, -GroundTraceHalfLength)
-				|| Mean - CurrentYZ > ObstacleCellCornerZMinDifferenceFromMean
-				|| Mean - PreviousYZ > ObstacleCellCornerZMinDifferenceFromMean
-				|| Mean - PreviousXZs[CurrentIndex] > ObstacleCellCornerZMinDifferenceFromMean
-				|| Mean - PreviousXZs[CurrentIndex - 1] > ObstacleCellCornerZMinDifferenceFromMean)
+			if (IsNatureObstacleCell(PreviousXZs[CurrentIndex - 1], PreviousXZs[CurrentIndex], PreviousYZ, CurrentYZ, GroundTraceHalfLength, ObstacleCellCornerZMinDifferenceFromMean))
 			{
 				GridLayers[static_cast<uint8>(EUEGridLayer::NatureObstacle)][GetUnsignedCellCoordsUnsafe(CurrentCellCoords - FIntPoint{ 1, 1 })] = true;
 			}
@@ -174,6 +531,152 @@ void UUEGridComponent::FillNatureObstacleLayer()
 	}
 }
 
+void UUEGridComponent::FillNatureObstacleLayerInParallel()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridComponent::FillNatureObstacleLayerInParallel);
+	check(GridLayers.Num() == static_cast<uint8>(EUEGridLayer::LAYERS_NUM));
+	UWorld const * const World = GetWorld();
+	if (UNLIKELY(!World) || GridRect.IsEmpty())
+	{
+		return;
+	}
+	float const GridCellSize = UUEGridLibrary::GetGridCellSize(this);
+	FIntPoint const GridSize = GetGridSize();
+
+	// Pass one: heights of all cell corners, column by column. Scene queries are thread safe, so columns are traced on worker threads.
+	int32 const CornersPerColumnNum = GridSize.Y + 1;
+	TArray<float> CornersZs;
+	CornersZs.SetNumUninitialized((GridSize.X + 1) * CornersPerColumnNum);
+	ParallelFor(GridSize.X + 1, [this, World, GridCellSize, CornersPerColumnNum, &CornersZs](int32 const X)
+		{
+			float * const ColumnZs = CornersZs.GetData() + X * CornersPerColumnNum;
+			for (int32 Y = 0; Y < CornersPerColumnNum; ++Y)
+			{
+				ColumnZs[Y] = GetGridCellCornerZUnsafe(GridRect.Min + FIntPoint{ X, Y }, World, GridCellSize);
+			}
+		});
+
+	// Pass two: cells classification into words of layer columns, 4 cells at a time.
+	FUEGridLayer & Layer = GetLayer(EUEGridLayer::NatureObstacle);
+	int32 const WordsPerColumnNum = Layer.GetYSize() / FUEGridLayer::NumCellsPerColumnWord;
+	TArray<FUEGridLayer::WordType> ColumnsWords;
+	ColumnsWords.SetNumZeroed(Layer.GetXSize() * WordsPerColumnNum);
+	ParallelFor(GridSize.X, [this, GridSize, CornersPerColumnNum, WordsPerColumnNum, &CornersZs, &ColumnsWords](int32 const X)
+		{
+			constexpr int32 NumCellsPerVector = 4;
+			static_assert(FUEGridLayer::NumCellsPerColumnWord % NumCellsPerVector == 0);
+			VectorRegister4Float const NoHitZ = VectorSetFloat1(-GroundTraceHalfLength);
+			VectorRegister4Float const MinDifferenceFromMean = VectorSetFloat1(ObstacleCellCornerZMinDifferenceFromMean);
+			float const * const MinXZs = CornersZs.GetData() + X * CornersPerColumnNum;
+			float const * const MaxXZs = MinXZs + CornersPerColumnNum;
+			FUEGridLayer::WordType * const Words = ColumnsWords.GetData() + X * WordsPerColumnNum;
+			int32 Y = 0;
+			for (; Y + NumCellsPerVector <= GridSize.Y; Y += NumCellsPerVector)
+			{
+				Words[Y / FUEGridLayer::NumCellsPerColumnWord] |= static_cast<FUEGridLayer::WordType>(GetNatureObstacleCellsBits(MinXZs + Y, MaxXZs + Y, NoHitZ, MinDifferenceFromMean)) << (Y % FUEGridLayer::NumCellsPerColumnWord);
+			}
+			for (; Y < GridSize.Y; ++Y)
+			{
+				bool const bIsObstacle = IsNatureObstacleCell(MinXZs[Y], MinXZs[Y + 1], MaxXZs[Y], MaxXZs[Y + 1], GroundTraceHalfLength, ObstacleCellCornerZMinDifferenceFromMean);
+				Words[Y / FUEGridLayer::NumCellsPerColumnWord] |= static_cast<FUEGridLayer::WordType>(bIsObstacle) << (Y % FUEGridLayer::NumCellsPerColumnWord);
+			}
+		});
+	Layer.SetAllCells(ColumnsWords);
+}
+
+bool UUEGridComponent::LoadBakedNatureObstacleLayer()
+{
+	check(GridLayers.Num() == static_cast<uint8>(EUEGridLayer::LAYERS_NUM));
+	UWorld const * const World = GetWorld();
+	if (BakedNatureObstacleLayer.IsEmpty() || UNLIKELY(!World))
+	{
+		return false;
+	}
+	if (CalculateNatureObstacleLayerHash(World) != BakedNatureObstacleLayerHash)
+	{
+		UE_LOGFMT(LogUE, Warning, "Baked nature obstacle layer of UUEGridComponent \"{0}\" is outdated, it will be traced. Bake it again.", GetName());
+		return false;
+	}
+
+	TArray<uint8> SerializedLayer;
+	SerializedLayer.SetNumUninitialized(BakedNatureObstacleLayerUncompressedSize);
+	if (!FCompression::UncompressMemory(NAME_Oodle, SerializedLayer.GetData(), SerializedLayer.Num(), BakedNatureObstacleLayer.GetData(), BakedNatureObstacleLayer.Num()))
+	{
+		UE_LOGFMT(LogUE, Warning, "Baked nature obstacle layer of UUEGridComponent \"{0}\" cannot be decompressed.", GetName());
+		return false;
+	}
+	FMemoryReader Reader{ SerializedLayer };
+	FUEGridLayer & Layer = GetLayer(EUEGridLayer::NatureObstacle);
+	FUintPoint const LayerSize = Layer.GetSize();
+	Layer.Serialize(Reader);
+	if (Reader.IsError() || Layer.GetSize() != LayerSize)
+	{
+		UE_LOGFMT(LogUE, Warning, "Baked nature obstacle layer of UUEGridComponent \"{0}\" is corrupted.", GetName());
+		Layer = FUEGridLayer{ static_cast<FUintPoint>(GetGridSize()), Layer.GetStorage() };
+		return false;
+	}
+	UpdatePathBlockingLayers(EUEGridLayer::NatureObstacle, GridRect);
+	return true;
+}
+
+bool UUEGridComponent::ShouldStreamGridLayers() const
+{
+	UWorld const * const World = GetWorld();
+	return bStreamGridLayers && World && World->IsGameWorld() && !World->bIsTearingDown;
+}
+
+void UUEGridComponent::FinishStreamingInGridLayers(TArray<FUEGridLayer> && StreamedInGridLayers)
+{
+	check(bIsStreamingInGridLayers);
+	bIsStreamingInGridLayers = false;
+	bool bAreLayersValid = StreamedInGridLayers.Num() == GridLayers.Num();
+	for (int32 LayerIndex = 0; bAreLayersValid && LayerIndex < GridLayers.Num(); ++LayerIndex)
+	{
+		bAreLayersValid = StreamedInGridLayers[LayerIndex].GetSize() == GridLayers[LayerIndex].GetSize();
+	}
+	if (bAreLayersValid)
+	{
+		GridLayers = MoveTemp(StreamedInGridLayers);
+		// Nature obstacle layer change updates all layers blocked for paths.
+		UpdatePathBlockingLayers(EUEGridLayer::NatureObstacle, GridRect);
+	}
+	else
+	{
+		UE_LOGFMT(LogUE, Warning, "Streamed out layers of UUEGridComponent \"{0}\" cannot be restored, they are filled again.", GetName());
+		bAreGridLayersStreamedIn = false;
+		if (HasBegunPlay() && !LoadBakedNatureObstacleLayer())
+		{
+			FillNatureObstacleLayer();
+		}
+	}
+
+	if (UUEGridSystem * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	{
+		GridSystem->RegisterGridComponent(this);
+	}
+}
+
+void UUEGridComponent::UpdatePathBlockingLayers(EUEGridLayer const ChangedGridLayer, FIntRect const & Rect)
+{
+	bool const bAreAllAffected = ChangedGridLayer == EUEGridLayer::NatureObstacle || ChangedGridLayer == EUEGridLayer::Construction;
+	int32 const ChangedPathGridLayerIndex = GetPathGridLayerIndex(ChangedGridLayer);
+	if (!bAreAllAffected && ChangedPathGridLayerIndex == INDEX_NONE)
+	{
+		return;
+	}
+	FIntRect ClippedRect = GetGridRect();
+	ClippedRect.Clip(Rect);
+	FUintRect const UnsignedRect = GetUnsignedRectUnsafe(ClippedRect);
+	for (int32 PathGridLayerIndex = 0; PathGridLayerIndex < PathBlockingLayers.Num(); ++PathGridLayerIndex)
+	{
+		if (bAreAllAffected || PathGridLayerIndex == ChangedPathGridLayerIndex)
+		{
+			FUEGridLayer const & PathGridLayer = GetLayer(PathGridLayers[PathGridLayerIndex]);
+			PathBlockingLayers[PathGridLayerIndex].SetCellsToUnionWithDifference(UnsignedRect, GetLayer(EUEGridLayer::NatureObstacle), GetLayer(EUEGridLayer::Construction), PathGridLayer);
+		}
+	}
+}
+
 FUEGridLayer & UUEGridComponent::GetLayer(EUEGridLayer const GridLayer)
 {
 	return GridLayers[static_cast<uint8>(GridLayer)];
@@ -184,6 +687,16 @@ FUEGridLayer const & UUEGridComponent::GetLayer(EUEGridLayer const GridLayer) co
 	return GridLayers[static_cast<uint8>(GridLayer)];
 }
 
+TArray<FUEGridLayer const *> UUEGridComponent::GetLayers(TConstArrayView<EUEGridLayer> const GridLayersToCheck) const
+{
+	TArray<FUEGridLayer const *> Layers;
+	for (EUEGridLayer const GridLayer : GridLayersToCheck)
+	{
+		Layers.Emplace(&GetLayer(GridLayer));
+	}
+	return Layers;
+}
+
 FUintPoint UUEGridComponent::GetUnsignedCellCoordsUnsafe(FIntPoint const SignedCellCoords) const
 {
 	return FUintPoint{ SignedCellCoords - GridRect.Min };
@@ -206,3 +719,57 @@ double UUEGridComponent::GetGridCellCornerZUnsafe(FIntPoint const Coords, UWorld
 	}
 	return End.Z;
 }
+
+uint32 UUEGridComponent::CalculateNatureObstacleLayerHash(UWorld const * const World) const
+{
+	float const GridCellSize = UUEGridLibrary::GetGridCellSize(this);
+	uint32 Hash = GetTypeHash(NatureObstacleLayerBakeVersion);
+	Hash = HashCombine(Hash, GetTypeHash(GridRect.Min));
+	Hash = HashCombine(Hash, GetTypeHash(GridRect.Max));
+	Hash = HashCombine(Hash, GetTypeHash(GridCellSize));
+	Hash = HashCombine(Hash, GetTypeHash(ObstacleCellCornerZMinDifferenceFromMean));
+	Hash = HashCombine(Hash, GetTypeHash(GroundTraceHalfLength));
+	Hash = HashCombine(Hash, GetTypeHash(static_cast<uint8>(GroundTraceChannel)));
+
+	// Heightfield of landscape collision gets new guid on every edit, so it changes even if no probe below is moved.
+	FBox2D const GridBox{ FVector2D{ GridRect.Min } * GridCellSize, FVector2D{ GridRect.Max } * GridCellSize };
+	TArray<TPair<FGuid, FVector>> Heightfields;
+	for (TActorIterator<ALandscapeProxy> It{ World }; It; ++It)
+	{
+		for (ULandscapeHeightfieldCollisionComponent const * const CollisionComponent : It->CollisionComponents)
+		{
+			if (!CollisionComponent)
+			{
+				continue;
+			}
+			FBox const Bounds = CollisionComponent->Bounds.GetBox();
+			if (GridBox.Intersect(FBox2D{ FVector2D{ Bounds.Min }, FVector2D{ Bounds.Max } }))
+			{
+				Heightfields.Emplace(CollisionComponent->HeightfieldGuid, CollisionComponent->GetComponentLocation());
+			}
+		}
+	}
+	// Order of proxies isn't stable, so heightfields are hashed in order of their guids.
+	Heightfields.Sort([](TPair<FGuid, FVector> const & A, TPair<FGuid, FVector> const & B)
+		{
+			return A.Key < B.Key;
+		});
+	for (TPair<FGuid, FVector> const & Heightfield : Heightfields)
+	{
+		Hash = HashCombine(Hash, GetTypeHash(Heightfield.Key));
+		Hash = HashCombine(Hash, GetTypeHash(Heightfield.Value));
+	}
+
+	// Other geometry of GroundTraceChannel, e.g. rocks, is sampled.
+	for (int32 XProbeIndex = 0; XProbeIndex < NatureObstacleLayerHashProbesPerAxisNum; ++XProbeIndex)
+	{
+		for (int32 YProbeIndex = 0; YProbeIndex < NatureObstacleLayerHashProbesPerAxisNum; ++YProbeIndex)
+		{
+			FIntPoint const ProbeOffset{
+				static_cast<int32>(static_cast<int64>(GridRect.Width()) * XProbeIndex / (NatureObstacleLayerHashProbesPerAxisNum - 1)),
+				static_cast<int32>(static_cast<int64>(GridRect.Height()) * YProbeIndex / (NatureObstacleLayerHashProbesPerAxisNum - 1)) };
+			Hash = HashCombine(Hash, GetTypeHash(GetGridCellCornerZUnsafe(GridRect.Min + ProbeOffset, World, GridCellSize)));
+		}
+	}
+	return Hash;
+}
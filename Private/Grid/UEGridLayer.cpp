@@ -1,256 +1,1344 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "Grid/UEGridLayer.h"
+#include "Algo/BinarySearch.h"
+#include <atomic>
 
-FUEGridLayer::FUEGridLayer(FUintPoint const InSize)
+#if PLATFORM_CPU_X86_FAMILY && PLATFORM_ENABLE_VECTORINTRINSICS
+	#include <immintrin.h>
+	#define UE_GRID_LAYER_WITH_AVX2 PLATFORM_ALWAYS_HAS_AVX_2
+	#define UE_GRID_LAYER_WITH_SSE2 !PLATFORM_ALWAYS_HAS_AVX_2
+#else
+	#define UE_GRID_LAYER_WITH_AVX2 0
+	#define UE_GRID_LAYER_WITH_SSE2 0
+#endif
+
+namespace
 {
+	/** Generation of the latest change of any grid layer. */
+	std::atomic<uint64> LastGridLayerGeneration{ 0 };
+
+	template <typename WordType>
+	WordType CombineWords(WordType const WordA, WordType const WordB, EUEGridLayerOperation const Operation)
+	{
+		switch (Operation)
+		{
+			case EUEGridLayerOperation::And:
+			{
+				return WordA & WordB;
+			}
+			case EUEGridLayerOperation::Or:
+			{
+				return WordA | WordB;
+			}
+			case EUEGridLayerOperation::AndNot:
+			{
+				return WordA & ~WordB;
+			}
+			case EUEGridLayerOperation::Xor:
+			{
+				return WordA ^ WordB;
+			}
+			case EUEGridLayerOperation::Nor:
+			{
+				return ~(WordA | WordB);
+			}
+		}
+		checkNoEntry();
+		return 0;
+	}
+
+	template <typename WordType>
+	uint32 CountTrailingZeros(WordType const Word)
+	{
+		if constexpr (sizeof(WordType) == sizeof(uint64))
+		{
+			return static_cast<uint32>(FMath::CountTrailingZeros64(Word));
+		}
+		else
+		{
+			return FMath::CountTrailingZeros(Word);
+		}
+	}
+
+	template <typename WordType>
+	uint32 FloorLog2(WordType const Word)
+	{
+		if constexpr (sizeof(WordType) == sizeof(uint64))
+		{
+			return static_cast<uint32>(FMath::FloorLog2_64(Word));
+		}
+		else
+		{
+			return FMath::FloorLog2(Word);
+		}
+	}
+
+#if UE_GRID_LAYER_WITH_AVX2
+	template <typename WordType>
+	constexpr uint32 NumWordsPerAVX2Register = sizeof(__m256i) / sizeof(WordType);
+
+	__m256i CombineAVX2Words(__m256i const WordsA, __m256i const WordsB, EUEGridLayerOperation const Operation)
+	{
+		switch (Operation)
+		{
+			case EUEGridLayerOperation::And:
+			{
+				return _mm256_and_si256(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::Or:
+			{
+				return _mm256_or_si256(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::AndNot:
+			{
+				return _mm256_andnot_si256(WordsB, WordsA);
+			}
+			case EUEGridLayerOperation::Xor:
+			{
+				return _mm256_xor_si256(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::Nor:
+			{
+				return _mm256_xor_si256(_mm256_or_si256(WordsA, WordsB), _mm256_set1_epi32(-1));
+			}
+		}
+		checkNoEntry();
+		return _mm256_setzero_si256();
+	}
+
+	template <typename WordType>
+	__m256i GetAVX2WordsMask(uint32 const FirstRegisterWordIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask)
+	{
+		// Word is masked if FromWordIndex <= WordIndex < ToWordIndex. Indices are small, so signed comparison is fine.
+		// Index of 64-bit word is compared in both its 32-bit halves.
+		__m256i const Offsets = sizeof(WordType) == sizeof(uint64) ? _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3) : _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256i const WordIndices = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32>(FirstRegisterWordIndex)), Offsets);
+		__m256i const IsNotBeforeFrom = _mm256_cmpgt_epi32(WordIndices, _mm256_set1_epi32(static_cast<int32>(FromWordIndex) - 1));
+		__m256i const IsBeforeTo = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int32>(ToWordIndex)), WordIndices);
+		__m256i const Masks = sizeof(WordType) == sizeof(uint64) ? _mm256_set1_epi64x(static_cast<int64>(Mask)) : _mm256_set1_epi32(static_cast<int32>(Mask));
+		return _mm256_and_si256(_mm256_and_si256(IsNotBeforeFrom, IsBeforeTo), Masks);
+	}
+#elif UE_GRID_LAYER_WITH_SSE2
+	template <typename WordType>
+	constexpr uint32 NumWordsPerSSE2Register = sizeof(__m128i) / sizeof(WordType);
+
+	__m128i CombineSSE2Words(__m128i const WordsA, __m128i const WordsB, EUEGridLayerOperation const Operation)
+	{
+		switch (Operation)
+		{
+			case EUEGridLayerOperation::And:
+			{
+				return _mm_and_si128(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::Or:
+			{
+				return _mm_or_si128(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::AndNot:
+			{
+				return _mm_andnot_si128(WordsB, WordsA);
+			}
+			case EUEGridLayerOperation::Xor:
+			{
+				return _mm_xor_si128(WordsA, WordsB);
+			}
+			case EUEGridLayerOperation::Nor:
+			{
+				return _mm_xor_si128(_mm_or_si128(WordsA, WordsB), _mm_set1_epi32(-1));
+			}
+		}
+		checkNoEntry();
+		return _mm_setzero_si128();
+	}
+
+	template <typename WordType>
+	__m128i GetSSE2WordsMask(uint32 const FirstRegisterWordIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask)
+	{
+		// Word is masked if FromWordIndex <= WordIndex < ToWordIndex. Indices are small, so signed comparison is fine.
+		// Index of 64-bit word is compared in both its 32-bit halves, as SSE2 has no 64-bit comparison.
+		__m128i const Offsets = sizeof(WordType) == sizeof(uint64) ? _mm_setr_epi32(0, 0, 1, 1) : _mm_setr_epi32(0, 1, 2, 3);
+		__m128i const WordIndices = _mm_add_epi32(_mm_set1_epi32(static_cast<int32>(FirstRegisterWordIndex)), Offsets);
+		__m128i const IsNotBeforeFrom = _mm_cmpgt_epi32(WordIndices, _mm_set1_epi32(static_cast<int32>(FromWordIndex) - 1));
+		__m128i const IsBeforeTo = _mm_cmplt_epi32(WordIndices, _mm_set1_epi32(static_cast<int32>(ToWordIndex)));
+		__m128i const Masks = sizeof(WordType) == sizeof(uint64) ? _mm_set1_epi64x(static_cast<int64>(Mask)) : _mm_set1_epi32(static_cast<int32>(Mask));
+		return _mm_and_si128(_mm_and_si128(IsNotBeforeFrom, IsBeforeTo), Masks);
+	}
+#endif
+} // namespace
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::TUEGridLayer(FUintPoint const InSize, EStorage const InStorage, EAccess const InAccess, ETileOrder const InTileOrder)
+	: Storage(InStorage)
+	, Access(InAccess)
+	, TileOrder(InTileOrder)
+{
+	// Sparse storage allocates tiles on write, which cannot be done concurrently with reads.
+	check((Storage == EStorage::Dense) || (Access == EAccess::Exclusive));
 	SetSize(InSize);
 }
 
-FBitReference FUEGridLayer::operator [](FUintPoint const Coords)
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FCellReference TUEGridLayer<InWordType, InNumWordsPerTile>::operator [](FUintPoint const Coords)
+{
+	CheckRange(Coords);
+	return FCellReference{ *this, Coords };
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::operator [](FUintPoint const Coords) const
+{
+	return GetCell(Coords);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::GetCell(FUintPoint const Coords) const
+{
+	CheckRange(Coords);
+	FUintPoint const CoordsInTile = GetCoordsInTile(Coords);
+	bool const bValue = true;
+	return GetTileByCellCoords(Coords).GetCellsWord(CoordsInTile.X, WordType{ 1 } << CoordsInTile.Y, bValue) != 0;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetCell(FUintPoint const Coords, bool const bValue)
+{
+	CheckRange(Coords);
+	uint32 const TileIndex = GetTileIndex(Coords / FGridTile::GetSize());
+	FUintPoint const CoordsInTile = GetCoordsInTile(Coords);
+	WordType const Mask = WordType{ 1 } << CoordsInTile.Y;
+	if (Access == EAccess::Concurrent)
+	{
+		SetTileCells(TileIndex, CoordsInTile.X, CoordsInTile.X + 1, Mask, bValue);
+	}
+	else if (GetTile(TileIndex).GetCellsWord(CoordsInTile.X, Mask, bValue) == 0)
+	{
+		FGridTile & Tile = GetMutableTile(TileIndex);
+		bool const bWordValue = true;
+		Tile.SetCellsWord(CoordsInTile.X, Tile.GetCellsWord(CoordsInTile.X, FullWordMask, bWordValue) ^ Mask);
+		UpdateTileSummaries(TileIndex);
+		MarkTileChanged(TileIndex);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::Contains(FUintRect const & Rect, bool const bValue) const
+{
+	if (Rect.IsEmpty())
+	{
+		return false;
+	}
+	CheckRange(Rect);
+
+	bool const bIsVisitingFinished = VisitTileSpansInMemoryOrder(Rect, [this, bValue](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			if (TileSpan.CoversWholeTiles() && Access == EAccess::Exclusive)
+			{
+				// Whole tiles don't contain bValue only if all their cells are !bValue.
+				return (bValue ? EmptyTiles : FullTiles).AreAllSet(FirstTileIndex, TileSpan.TilesNum);
+			}
+			for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+			{
+				if (TileContains(TileIndex, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, bValue))
+				{
+					return false;
+				}
+			}
+			return true;
+		});
+	return !bIsVisitingFinished;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetCells(FUintRect const & Rect, bool const bValue)
+{
+	if (Rect.IsEmpty())
+	{
+		return;
+	}
+	CheckRange(Rect);
+
+	VisitTileSpans(Rect, [this, bValue](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			if (TileSpan.CoversWholeTiles() && Access == EAccess::Exclusive)
+			{
+				FTileSummary const & AlreadySetTiles = bValue ? FullTiles : EmptyTiles;
+				for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+				{
+					if (!AlreadySetTiles.Get(TileIndex))
+					{
+						MarkTileChanged(TileIndex);
+					}
+				}
+				if (Storage == EStorage::Sparse)
+				{
+					for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+					{
+						SetSharedTile(TileIndex, bValue ? FullTileSlot : EmptyTileSlot);
+					}
+				}
+				else if (TileOrder == ETileOrder::RowMajor)
+				{
+					// Slots of dense storage go in the same order as tiles.
+					FMemory::Memset(&GridLayerData[TileSlots[FirstTileIndex]], (bValue ? 0xff : 0), TileSpan.TilesNum * sizeof(FGridTile));
+				}
+				else
+				{
+					for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+					{
+						FMemory::Memset(&GridLayerData[TileSlots[TileIndex]], (bValue ? 0xff : 0), sizeof(FGridTile));
+					}
+				}
+				EmptyTiles.SetRange(FirstTileIndex, TileSpan.TilesNum, !bValue);
+				FullTiles.SetRange(FirstTileIndex, TileSpan.TilesNum, bValue);
+				return true;
+			}
+			for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+			{
+				SetTileCells(TileIndex, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, bValue);
+			}
+			return true;
+		});
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::Combine(TUEGridLayer const & SourceA, TUEGridLayer const & SourceB, EUEGridLayerOperation const Operation, FUintRect const & Rect)
+{
+	if (Rect.IsEmpty())
+	{
+		return;
+	}
+	CheckRange(Rect);
+	check((SourceA.GetSize() == GetSize()) && (SourceB.GetSize() == GetSize()));
+
+	FScopedRowsLock RowsLock(*this, Rect, SLT_Write);
+	VisitTileSpans(Rect, [this, &SourceA, &SourceB, Operation](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+			{
+				bool bValue;
+				if (GetUniformCombination(SourceA, SourceB, Operation, TileIndex, bValue))
+				{
+					SetTileCells(TileIndex, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, bValue);
+					continue;
+				}
+				if (Access == EAccess::Concurrent)
+				{
+					// Words are read and set atomically one by one, as cells may be read or set by SetCell meanwhile.
+					FGridTile const & TileA = SourceA.GetTile(TileIndex);
+					FGridTile const & TileB = SourceB.GetTile(TileIndex);
+					FGridTile & Tile = GetMutableTile(TileIndex);
+					bool bIsChanged = false;
+					for (uint32 WordIndex = TileSpan.FromWordIndex; WordIndex < TileSpan.ToWordIndex; ++WordIndex)
+					{
+						bool const bValue = true;
+						WordType const Cells = CombineWords(TileA.GetCellsWord(WordIndex, FullWordMask, bValue), TileB.GetCellsWord(WordIndex, FullWordMask, bValue), Operation);
+						bIsChanged |= Tile.SetCellsWordAtomically(WordIndex, TileSpan.Mask, Cells);
+					}
+					if (bIsChanged)
+					{
+						MarkTileChanged(TileIndex);
+					}
+					continue;
+				}
+				// Cells are combined into a copy first, so that tile which isn't changed is neither reallocated nor marked changed.
+				FGridTile const & Tile = GetTile(TileIndex);
+				FGridTile CombinedTile{ Tile };
+				CombinedTile.SetCellsCombined(SourceA.GetTile(TileIndex), SourceB.GetTile(TileIndex), Operation, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask);
+				if (FMemory::Memcmp(&CombinedTile, &Tile, sizeof(FGridTile)) != 0)
+				{
+					GetMutableTile(TileIndex) = CombinedTile;
+					UpdateTileSummaries(TileIndex);
+					MarkTileChanged(TileIndex);
+				}
+			}
+			return true;
+		});
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetCellsToUnionWithDifference(FUintRect const & Rect, TUEGridLayer const & UnitedLayer, TUEGridLayer const & MinuendLayer, TUEGridLayer const & SubtrahendLayer)
+{
+	if (Rect.IsEmpty())
+	{
+		return;
+	}
+	CheckRange(Rect);
+	check((UnitedLayer.GetSize() == GetSize()) && (MinuendLayer.GetSize() == GetSize()) && (SubtrahendLayer.GetSize() == GetSize()));
+
+	FScopedRowsLock RowsLock(*this, Rect, SLT_Write);
+	VisitTileSpans(Rect, [this, &UnitedLayer, &MinuendLayer, &SubtrahendLayer](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+			{
+				// Uniform source tiles give uniform result.
+				bool const bIsDifferenceFull = MinuendLayer.FullTiles.Get(TileIndex) && SubtrahendLayer.EmptyTiles.Get(TileIndex);
+				bool const bIsDifferenceEmpty = MinuendLayer.EmptyTiles.Get(TileIndex) || SubtrahendLayer.FullTiles.Get(TileIndex);
+				if (UnitedLayer.FullTiles.Get(TileIndex) || bIsDifferenceFull)
+				{
+					SetTileCells(TileIndex, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, true);
+					continue;
+				}
+				if (UnitedLayer.EmptyTiles.Get(TileIndex) && bIsDifferenceEmpty)
+				{
+					SetTileCells(TileIndex, TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, false);
+					continue;
+				}
+
+				FGridTile const & UnitedTile = UnitedLayer.GetTile(TileIndex);
+				FGridTile const & MinuendTile = MinuendLayer.GetTile(TileIndex);
+				FGridTile const & SubtrahendTile = SubtrahendLayer.GetTile(TileIndex);
+				FGridTile const & Tile = GetTile(TileIndex);
+				WordType NewWords[NumWordsPerTile];
+				bool bIsChanged = false;
+				for (uint32 WordIndex = TileSpan.FromWordIndex; WordIndex < TileSpan.ToWordIndex; ++WordIndex)
+				{
+					WordType const Cells = UnitedTile.GetCellsWord(WordIndex, TileSpan.Mask, true)
+						| (MinuendTile.GetCellsWord(WordIndex, TileSpan.Mask, true) & SubtrahendTile.GetCellsWord(WordIndex, TileSpan.Mask, false));
+					WordType const OldWord = Tile.GetCellsWord(WordIndex, FullWordMask, true);
+					NewWords[WordIndex] = (OldWord & ~TileSpan.Mask) | Cells;
+					bIsChanged |= NewWords[WordIndex] != OldWord;
+				}
+				if (bIsChanged)
+				{
+					FGridTile & MutableTile = GetMutableTile(TileIndex);
+					for (uint32 WordIndex = TileSpan.FromWordIndex; WordIndex < TileSpan.ToWordIndex; ++WordIndex)
+					{
+						if (Access == EAccess::Concurrent)
+						{
+							// Cells outside of span may be set by SetCell meanwhile.
+							MutableTile.SetCellsWordAtomically(WordIndex, TileSpan.Mask, NewWords[WordIndex]);
+						}
+						else
+						{
+							MutableTile.SetCellsWord(WordIndex, NewWords[WordIndex]);
+						}
+					}
+					UpdateTileSummaries(TileIndex);
+					MarkTileChanged(TileIndex);
+				}
+			}
+			return true;
+		});
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint64 TUEGridLayer<InWordType, InNumWordsPerTile>::CountCells(FUintRect const & Rect, bool const bValue) const
+{
+	if (Rect.IsEmpty())
+	{
+		return 0;
+	}
+	CheckRange(Rect);
+
+	uint64 CellsNum = 0;
+	VisitTileSpansInMemoryOrder(Rect, [this, bValue, &CellsNum](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			uint32 const TileSpanCellsNum = (TileSpan.ToWordIndex - TileSpan.FromWordIndex) * FMath::CountBits(TileSpan.Mask);
+			FTileSummary const & SameTiles = bValue ? FullTiles : EmptyTiles;
+			FTileSummary const & OppositeTiles = bValue ? EmptyTiles : FullTiles;
+			for (uint32 TileIndex = FirstTileIndex; TileIndex < FirstTileIndex + TileSpan.TilesNum; ++TileIndex)
+			{
+				if (SameTiles.Get(TileIndex))
+				{
+					CellsNum += TileSpanCellsNum;
+				}
+				else if (!OppositeTiles.Get(TileIndex))
+				{
+					CellsNum += GetTile(TileIndex).CountCells(TileSpan.FromWordIndex, TileSpan.ToWordIndex, TileSpan.Mask, bValue);
+				}
+			}
+			return true;
+		});
+	return CellsNum;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::ForEachCell(FUintRect const & Rect, bool const bValue, TFunctionRef<void (FUintPoint const)> Visitor) const
+{
+	if (Rect.IsEmpty())
+	{
+		return;
+	}
+	CheckRange(Rect);
+
+	VisitTileSpansInMemoryOrder(Rect, [this, bValue, &Visitor](FTileSpan const & TileSpan) -> bool
+		{
+			uint32 const FirstTileIndex = GetTileIndex(TileSpan.TileCoords);
+			FTileSummary const & OppositeTiles = bValue ? EmptyTiles : FullTiles;
+			for (uint32 TileOffset = 0; TileOffset < TileSpan.TilesNum; ++TileOffset)
+			{
+				uint32 const TileIndex = FirstTileIndex + TileOffset;
+				if (OppositeTiles.Get(TileIndex))
+				{
+					continue;
+				}
+				FUintPoint const TileOrigin = FUintPoint{ TileSpan.TileCoords.X + TileOffset, TileSpan.TileCoords.Y } * FGridTile::GetSize();
+				for (uint32 WordIndex = TileSpan.FromWordIndex; WordIndex < TileSpan.ToWordIndex; ++WordIndex)
+				{
+					for (WordType Word = GetTile(TileIndex).GetCellsWord(WordIndex, TileSpan.Mask, bValue); Word != 0; Word &= Word - 1)
+					{
+						Visitor(TileOrigin + FUintPoint{ WordIndex, CountTrailingZeros(Word) });
+					}
+				}
+			}
+			return true;
+		});
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetAllCells(TConstArrayView<WordType> const ColumnsWords)
+{
+	uint32 const WordsPerColumn = GetYTileNum();
+	check(ColumnsWords.Num() == GetXSize() * WordsPerColumn);
+	FScopedRowsLock RowsLock(*this, FUintRect{ FUintPoint{ 0, 0 }, GetSize() }, SLT_Write);
+	SetAllCells(ColumnsWords.GetData(), WordsPerColumn, 1);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::Erode(TUEGridLayer const & Source, FUintPoint const BoxSize)
+{
+	SetCellsToBoxCombination(Source, BoxSize, EUEGridLayerOperation::And);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::Dilate(TUEGridLayer const & Source, FUintPoint const BoxSize)
+{
+	SetCellsToBoxCombination(Source, BoxSize, EUEGridLayerOperation::Or);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetCellsToBoxCombination(TUEGridLayer const & Source, FUintPoint const BoxSize, EUEGridLayerOperation const Operation)
+{
+	check((Source.GetSize() == GetSize()) && (BoxSize.X > 0) && (BoxSize.Y > 0));
+	// Source is read under the lock too, as it may be this layer.
+	FScopedRowsLock RowsLock(*this, FUintRect{ FUintPoint{ 0, 0 }, GetSize() }, SLT_Write);
+	FRowsMask Mask;
+	Mask.Origin = FUintPoint{ 0, 0 };
+	Mask.ColumnsNum = GetXSize();
+	Mask.RowsNum = GetYTileNum();
+	Mask.Words.SetNumUninitialized(Mask.ColumnsNum * Mask.RowsNum);
+	for (uint32 RowIndex = 0; RowIndex < Mask.RowsNum; ++RowIndex)
+	{
+		WordType * const RowWords = Mask.Words.GetData() + RowIndex * Mask.ColumnsNum;
+		for (uint32 ColumnIndex = 0; ColumnIndex < Mask.ColumnsNum; ++ColumnIndex)
+		{
+			bool const bValue = true;
+			FGridTile const & SourceTile = Source.GetTile(Source.GetTileIndex(FUintPoint{ ColumnIndex / NumWordsPerTile, RowIndex }));
+			RowWords[ColumnIndex] = SourceTile.GetCellsWord(ColumnIndex % NumWordsPerTile, FullWordMask, bValue);
+		}
+	}
+	ApplyBoxToRowsMask(Mask, BoxSize, Operation);
+	SetAllCells(Mask.Words.GetData(), 1, Mask.ColumnsNum);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetAllCells(WordType const * const Words, uint32 const ColumnStride, uint32 const RowStride)
+{
+	for (uint32 TileY = 0; TileY < GetYTileNum(); ++TileY)
+	{
+		for (uint32 TileX = 0; TileX < GetXTileNum(); ++TileX)
+		{
+			uint32 const TileIndex = GetTileIndex(FUintPoint{ TileX, TileY });
+			WordType const * const FirstWord = Words + TileX * NumWordsPerTile * ColumnStride + TileY * RowStride;
+			FGridTile const & OldTile = GetTile(TileIndex);
+			WordType AllCells = FullWordMask;
+			WordType AnyCells = 0;
+			bool bIsChanged = false;
+			for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+			{
+				bool const bValue = true;
+				AllCells &= FirstWord[WordIndex * ColumnStride];
+				AnyCells |= FirstWord[WordIndex * ColumnStride];
+				bIsChanged |= OldTile.GetCellsWord(WordIndex, FullWordMask, bValue) != FirstWord[WordIndex * ColumnStride];
+			}
+			if (!bIsChanged)
+			{
+				continue;
+			}
+			if (Access == EAccess::Exclusive)
+			{
+				bool const bIsEmpty = AnyCells == 0;
+				bool const bIsFull = AllCells == FullWordMask;
+				EmptyTiles.Set(TileIndex, bIsEmpty);
+				FullTiles.Set(TileIndex, bIsFull);
+				if (Storage == EStorage::Sparse && (bIsEmpty || bIsFull))
+				{
+					SetSharedTile(TileIndex, bIsEmpty ? EmptyTileSlot : FullTileSlot);
+					MarkTileChanged(TileIndex);
+					continue;
+				}
+			}
+			FGridTile & Tile = GetMutableTile(TileIndex);
+			for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+			{
+				Tile.SetCellsWord(WordIndex, FirstWord[WordIndex * ColumnStride]);
+			}
+			MarkTileChanged(TileIndex);
+		}
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FindFreeRects(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, TArray<FUintPoint> & OutAnchors)
+{
+	FRowsMask Mask;
+	FindFreeRectsMask(Layers, Rect, RectSize, Mask);
+	for (uint32 RowIndex = 0; RowIndex < Mask.RowsNum; ++RowIndex)
+	{
+		WordType const * const RowWords = Mask.Words.GetData() + RowIndex * Mask.ColumnsNum;
+		for (uint32 ColumnIndex = 0; ColumnIndex < Mask.ColumnsNum; ++ColumnIndex)
+		{
+			for (WordType Word = RowWords[ColumnIndex]; Word != 0; Word &= Word - 1)
+			{
+				OutAnchors.Emplace(Mask.Origin + FUintPoint{ ColumnIndex, RowIndex * NumBitsPerWord + CountTrailingZeros(Word) });
+			}
+		}
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FindNearestFreeRect(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, FIntPoint const DesiredAnchor, FUintPoint & OutAnchor)
+{
+	FRowsMask Mask;
+	FindFreeRectsMask(Layers, Rect, RectSize, Mask);
+	if (Mask.RowsNum == 0)
+	{
+		return false;
+	}
+
+	auto const GetWord = [&Mask](uint32 const RowIndex, uint32 const ColumnIndex) -> WordType
+		{
+			return Mask.Words[RowIndex * Mask.ColumnsNum + ColumnIndex];
+		};
+	// Nearest anchors to DesiredAnchor along Y are searched from TargetBit in both directions.
+	uint32 const BitsNum = Mask.RowsNum * NumBitsPerWord;
+	uint32 const TargetBit = static_cast<uint32>(FMath::Clamp<int64>(static_cast<int64>(DesiredAnchor.Y) - Mask.Origin.Y, 0, BitsNum - 1));
+	uint32 const TargetRowIndex = TargetBit / NumBitsPerWord;
+	uint32 const TargetBitInWord = TargetBit % NumBitsPerWord;
+
+	bool bIsFound = false;
+	uint64 BestDistanceSquared = MAX_uint64;
+	auto const TryAnchor = [&](uint32 const ColumnIndex, uint32 const Bit)
+		{
+			int64 const DX = static_cast<int64>(Mask.Origin.X + ColumnIndex) - DesiredAnchor.X;
+			int64 const DY = static_cast<int64>(Mask.Origin.Y + Bit) - DesiredAnchor.Y;
+			uint64 const DistanceSquared = static_cast<uint64>(DX * DX + DY * DY);
+			if (DistanceSquared < BestDistanceSquared)
+			{
+				BestDistanceSquared = DistanceSquared;
+				OutAnchor = Mask.Origin + FUintPoint{ ColumnIndex, Bit };
+				bIsFound = true;
+			}
+		};
+
+	for (uint32 ColumnIndex = 0; ColumnIndex < Mask.ColumnsNum; ++ColumnIndex)
+	{
+		int64 const DX = static_cast<int64>(Mask.Origin.X + ColumnIndex) - DesiredAnchor.X;
+		if (static_cast<uint64>(DX * DX) >= BestDistanceSquared)
+		{
+			continue;
+		}
+
+		// Last anchor at or before TargetBit.
+		uint32 RowIndex = TargetRowIndex;
+		WordType Word = GetWord(RowIndex, ColumnIndex) & (FullWordMask >> (NumBitsPerWord - 1 - TargetBitInWord));
+		while (Word == 0 && RowIndex > 0)
+		{
+			Word = GetWord(--RowIndex, ColumnIndex);
+		}
+		if (Word != 0)
+		{
+			TryAnchor(ColumnIndex, RowIndex * NumBitsPerWord + FloorLog2(Word));
+		}
+
+		// First anchor at or after TargetBit.
+		RowIndex = TargetRowIndex;
+		Word = GetWord(RowIndex, ColumnIndex) & (FullWordMask << TargetBitInWord);
+		while (Word == 0 && RowIndex + 1 < Mask.RowsNum)
+		{
+			Word = GetWord(++RowIndex, ColumnIndex);
+		}
+		if (Word != 0)
+		{
+			TryAnchor(ColumnIndex, RowIndex * NumBitsPerWord + CountTrailingZeros(Word));
+		}
+	}
+	return bIsFound;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+FUintPoint TUEGridLayer<InWordType, InNumWordsPerTile>::GetSize() const
+{
+	return Size;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetXSize() const
+{
+	return Size.X;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetYSize() const
+{
+	return Size.Y;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::EStorage TUEGridLayer<InWordType, InNumWordsPerTile>::GetStorage() const
+{
+	return Storage;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::EAccess TUEGridLayer<InWordType, InNumWordsPerTile>::GetAccess() const
+{
+	return Access;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::ETileOrder TUEGridLayer<InWordType, InNumWordsPerTile>::GetTileOrder() const
+{
+	return TileOrder;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint64 TUEGridLayer<InWordType, InNumWordsPerTile>::GetCurrentGeneration()
+{
+	return LastGridLayerGeneration.load(std::memory_order_acquire);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::GetChangedRects(uint64 const SinceGeneration, TArray<FUintRect> & OutRects) const
+{
+	if (SinceGeneration < SizeGeneration)
+	{
+		OutRects.Emplace(FUintPoint{ 0, 0 }, Size);
+		return;
+	}
+	TArray<uint32> ChangedTiles;
+	GetChangedTiles(SinceGeneration, ChangedTiles);
+	ChangedTiles.Sort();
+
+	FUintPoint const TileSize = FGridTile::GetSize();
+	for (int32 Index = 0; Index < ChangedTiles.Num();)
+	{
+		uint32 const FirstTileIndex = ChangedTiles[Index];
+		uint32 const TileY = FirstTileIndex / GetXTileNum();
+		uint32 TilesNum = 1;
+		while (Index + TilesNum < static_cast<uint32>(ChangedTiles.Num()) && ChangedTiles[Index + TilesNum] == FirstTileIndex + TilesNum
+			&& (FirstTileIndex + TilesNum) / GetXTileNum() == TileY)
+		{
+			++TilesNum;
+		}
+		FUintPoint const Min{ (FirstTileIndex % GetXTileNum()) * TileSize.X, TileY * TileSize.Y };
+		OutRects.Emplace(Min, Min + FUintPoint{ TilesNum * TileSize.X, TileSize.Y });
+		Index += TilesNum;
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::CopyChangedTiles(TUEGridLayer const & Source, uint64 const SinceGeneration)
+{
+	if (Size != Source.Size || Storage != Source.Storage || Access != Source.Access || TileOrder != Source.TileOrder || SinceGeneration < Source.SizeGeneration)
+	{
+		*this = Source;
+		return;
+	}
+	TArray<uint32> ChangedTiles;
+	Source.GetChangedTiles(SinceGeneration, ChangedTiles);
+	FScopedRowsLock RowsLock(*this, FUintRect{ FUintPoint{ 0, 0 }, GetSize() }, SLT_Write);
+	for (uint32 const TileIndex : ChangedTiles)
+	{
+		if (Access == EAccess::Concurrent)
+		{
+			// No summaries, storage is dense. Words are copied with atomic loads and stores, as cells may be read meanwhile.
+			FGridTile const & SourceTile = Source.GetTile(TileIndex);
+			FGridTile & Tile = GetMutableTile(TileIndex);
+			for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+			{
+				bool const bValue = true;
+				Tile.SetCellsWord(WordIndex, SourceTile.GetCellsWord(WordIndex, FullWordMask, bValue));
+			}
+			TileGenerations[TileIndex] = std::atomic_ref<uint64>(const_cast<uint64 &>(Source.TileGenerations[TileIndex])).load(std::memory_order_relaxed);
+			continue;
+		}
+		bool const bIsEmpty = Source.EmptyTiles.Get(TileIndex);
+		bool const bIsFull = Source.FullTiles.Get(TileIndex);
+		EmptyTiles.Set(TileIndex, bIsEmpty);
+		FullTiles.Set(TileIndex, bIsFull);
+		if (Storage == EStorage::Sparse && (bIsEmpty || bIsFull))
+		{
+			SetSharedTile(TileIndex, bIsEmpty ? EmptyTileSlot : FullTileSlot);
+		}
+		else
+		{
+			GetMutableTile(TileIndex) = Source.GetTile(TileIndex);
+		}
+		// Changed tiles go in order of their changes, so log stays sorted by generations.
+		TileGenerations[TileIndex] = Source.TileGenerations[TileIndex];
+		LogTileChange(TileIndex, TileGenerations[TileIndex]);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+SIZE_T TUEGridLayer<InWordType, InNumWordsPerTile>::GetAllocatedSize() const
+{
+	return TileSlots.GetAllocatedSize() + GridLayerData.GetAllocatedSize() + FreeTileSlots.GetAllocatedSize() + EmptyTiles.GetAllocatedSize() + FullTiles.GetAllocatedSize()
+		+ TileGenerations.GetAllocatedSize() + TileChangesLog.GetAllocatedSize();
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::Serialize(FArchive & Ar)
+{
+	FUintPoint SerializedSize = Size;
+	Ar << SerializedSize;
+	if (Ar.IsLoading())
+	{
+		SetSize(SerializedSize);
+	}
+	uint32 const TilesNum = TileSlots.Num();
+	EmptyTiles.Serialize(Ar, TilesNum);
+	FullTiles.Serialize(Ar, TilesNum);
+	if (Ar.IsError())
+	{
+		if (Ar.IsLoading())
+		{
+			SetSize(Size);
+		}
+		return;
+	}
+
+	for (uint32 TileIndex = 0; TileIndex < TilesNum; ++TileIndex)
+	{
+		if (EmptyTiles.Get(TileIndex))
+		{
+			// Tiles are empty after SetSize.
+			continue;
+		}
+		if (FullTiles.Get(TileIndex))
+		{
+			if (Ar.IsLoading())
+			{
+				if (Storage == EStorage::Sparse)
+				{
+					SetSharedTile(TileIndex, FullTileSlot);
+				}
+				else
+				{
+					FMemory::Memset(&GetMutableTile(TileIndex), 0xff, sizeof(FGridTile));
+				}
+			}
+			continue;
+		}
+		// Mixed tiles always have their own slots, so no allocation happens on saving.
+		GetMutableTile(TileIndex).Serialize(Ar);
+	}
+	if (Ar.IsLoading() && Access == EAccess::Concurrent)
+	{
+		EmptyTiles.Init(TilesNum, false);
+		FullTiles.Init(TilesNum, false);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+template <typename VisitorType>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::VisitTileSpans(FUintRect const & Rect, VisitorType && Visitor) const
+{
+	check(!Rect.IsEmpty());
+	FUintRect const TilesRect{ Rect.Min / FGridTile::GetSize(), (Rect.Max - FUintPoint{ 1, 1 }) / FGridTile::GetSize() + FUintPoint{ 1, 1 } };
+	uint32 const StartWordIndex = Rect.Min.X % NumWordsPerTile;
+	WordType const StartMask = FullWordMask << (Rect.Min.Y % NumBitsPerWord);
+	uint32 const EndWordIndex = ((Rect.Max.X - 1) % NumWordsPerTile) + 1;
+	WordType const EndMask = FullWordMask >> ((NumBitsPerWord - (Rect.Max.Y % NumBitsPerWord)) % NumBitsPerWord);
+
+	FTileSpan TileSpan;
+	for (uint32 TileY = TilesRect.Min.Y; TileY < TilesRect.Max.Y; ++TileY)
+	{
+		TileSpan.Mask = FullWordMask;
+		if (TileY == TilesRect.Min.Y)
+		{
+			TileSpan.Mask &= StartMask;
+		}
+		if (TileY == TilesRect.Max.Y - 1)
+		{
+			TileSpan.Mask &= EndMask;
+		}
+
+		uint32 const FirstTileX = TilesRect.Min.X;
+		uint32 const LastTileX = TilesRect.Max.X - 1;
+		TileSpan.TileCoords = FUintPoint{ FirstTileX, TileY };
+		TileSpan.TilesNum = 1;
+		TileSpan.FromWordIndex = StartWordIndex;
+		if (FirstTileX == LastTileX)
+		{
+			TileSpan.ToWordIndex = EndWordIndex;
+			if (!Visitor(static_cast<FTileSpan const &>(TileSpan)))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		TileSpan.ToWordIndex = NumWordsPerTile;
+		if (!Visitor(static_cast<FTileSpan const &>(TileSpan)))
+		{
+			return false;
+		}
+		if (LastTileX - FirstTileX > 1)
+		{
+			TileSpan.TileCoords = FUintPoint{ FirstTileX + 1, TileY };
+			TileSpan.TilesNum = LastTileX - FirstTileX - 1;
+			TileSpan.FromWordIndex = 0;
+			if (!Visitor(static_cast<FTileSpan const &>(TileSpan)))
+			{
+				return false;
+			}
+		}
+		TileSpan.TileCoords = FUintPoint{ LastTileX, TileY };
+		TileSpan.TilesNum = 1;
+		TileSpan.FromWordIndex = 0;
+		TileSpan.ToWordIndex = EndWordIndex;
+		if (!Visitor(static_cast<FTileSpan const &>(TileSpan)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+template <typename VisitorType>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::VisitTileSpansInMemoryOrder(FUintRect const & Rect, VisitorType && Visitor) const
+{
+	if (TileOrder == ETileOrder::RowMajor || Storage == EStorage::Sparse)
+	{
+		return VisitTileSpans(Rect, Visitor);
+	}
+	check(!Rect.IsEmpty());
+	FUintRect const TilesRect{ Rect.Min / FGridTile::GetSize(), (Rect.Max - FUintPoint{ 1, 1 }) / FGridTile::GetSize() + FUintPoint{ 1, 1 } };
+	auto TileVisitor = [&Rect, &TilesRect, &Visitor](FUintPoint const TileCoords) -> bool
+		{
+			FTileSpan TileSpan;
+			TileSpan.TileCoords = TileCoords;
+			TileSpan.TilesNum = 1;
+			TileSpan.FromWordIndex = TileCoords.X == TilesRect.Min.X ? Rect.Min.X % NumWordsPerTile : 0;
+			TileSpan.ToWordIndex = TileCoords.X == TilesRect.Max.X - 1 ? ((Rect.Max.X - 1) % NumWordsPerTile) + 1 : NumWordsPerTile;
+			TileSpan.Mask = FullWordMask;
+			if (TileCoords.Y == TilesRect.Min.Y)
+			{
+				TileSpan.Mask &= FullWordMask << (Rect.Min.Y % NumBitsPerWord);
+			}
+			if (TileCoords.Y == TilesRect.Max.Y - 1)
+			{
+				TileSpan.Mask &= FullWordMask >> ((NumBitsPerWord - (Rect.Max.Y % NumBitsPerWord)) % NumBitsPerWord);
+			}
+			return Visitor(static_cast<FTileSpan const &>(TileSpan));
+		};
+	// Recursion starts from the smallest aligned block containing TilesRect, as its tiles are visited in the same order from the layer block,
+	// so that small rects don't descend from the layer block.
+	uint32 const DifferentBits = (TilesRect.Min.X ^ (TilesRect.Max.X - 1)) | (TilesRect.Min.Y ^ (TilesRect.Max.Y - 1));
+	uint32 const BlockSize = DifferentBits != 0 ? 2u << FMath::FloorLog2(DifferentBits) : 1u;
+	FUintPoint const BlockOrigin{ TilesRect.Min.X & ~(BlockSize - 1), TilesRect.Min.Y & ~(BlockSize - 1) };
+	return VisitTilesInMortonOrder(TilesRect, BlockOrigin, BlockSize, TileVisitor);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+template <typename VisitorType>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::VisitTilesInMortonOrder(FUintRect const & TilesRect, FUintPoint const BlockOrigin, uint32 const BlockSize, VisitorType & Visitor) const
+{
+	// Blocks outside of TilesRect are skipped, so cost is proportional to number of tiles plus perimeter times depth.
+	if (BlockOrigin.X >= TilesRect.Max.X || BlockOrigin.Y >= TilesRect.Max.Y || BlockOrigin.X + BlockSize <= TilesRect.Min.X || BlockOrigin.Y + BlockSize <= TilesRect.Min.Y)
+	{
+		return true;
+	}
+	if (BlockSize == 1)
+	{
+		return Visitor(BlockOrigin);
+	}
+	uint32 const QuadrantSize = BlockSize / 2;
+	for (uint32 Quadrant = 0; Quadrant < 4; ++Quadrant)
+	{
+		FUintPoint const QuadrantOrigin = BlockOrigin + FUintPoint{ (Quadrant & 1) * QuadrantSize, (Quadrant >> 1) * QuadrantSize };
+		if (!VisitTilesInMortonOrder(TilesRect, QuadrantOrigin, QuadrantSize, Visitor))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetMortonBlockSize() const
+{
+	return FMath::RoundUpToPowerOfTwo(FMath::Max3(GetXTileNum(), GetYTileNum(), 1u));
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetTileCells(uint32 const TileIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue)
+{
+	if (Access == EAccess::Concurrent)
+	{
+		if (GetMutableTile(TileIndex).SetCellsAtomically(FromWordIndex, ToWordIndex, Mask, bValue))
+		{
+			MarkTileChanged(TileIndex);
+		}
+	}
+	else if (TileContains(TileIndex, FromWordIndex, ToWordIndex, Mask, !bValue))
+	{
+		GetMutableTile(TileIndex).SetCells(FromWordIndex, ToWordIndex, Mask, bValue);
+		UpdateTileSummaries(TileIndex);
+		MarkTileChanged(TileIndex);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::GetUniformCombination(TUEGridLayer const & SourceA, TUEGridLayer const & SourceB, EUEGridLayerOperation const Operation, uint32 const TileIndex, bool & bOutValue)
+{
+	bool const bIsAEmpty = SourceA.EmptyTiles.Get(TileIndex);
+	bool const bIsAFull = SourceA.FullTiles.Get(TileIndex);
+	bool const bIsBEmpty = SourceB.EmptyTiles.Get(TileIndex);
+	bool const bIsBFull = SourceB.FullTiles.Get(TileIndex);
+	if ((bIsAEmpty || bIsAFull) && (bIsBEmpty || bIsBFull))
+	{
+		bOutValue = CombineWords(bIsAFull ? FullWordMask : 0, bIsBFull ? FullWordMask : 0, Operation) != 0;
+		return true;
+	}
+	// One uniform source may be enough.
+	switch (Operation)
+	{
+		case EUEGridLayerOperation::And:
+		case EUEGridLayerOperation::AndNot:
+		{
+			bOutValue = false;
+			return bIsAEmpty || (Operation == EUEGridLayerOperation::And ? bIsBEmpty : bIsBFull);
+		}
+		case EUEGridLayerOperation::Or:
+		case EUEGridLayerOperation::Nor:
+		{
+			bOutValue = Operation == EUEGridLayerOperation::Or;
+			return bIsAFull || bIsBFull;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::TileContains(uint32 const TileIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const
+{
+	if (EmptyTiles.Get(TileIndex))
+	{
+		return !bValue;
+	}
+	if (FullTiles.Get(TileIndex))
+	{
+		return bValue;
+	}
+	FGridTile const & Tile = GetTile(TileIndex);
+	if (Access == EAccess::Concurrent)
+	{
+		// Words are read one by one with relaxed atomic loads instead of vector loads.
+		for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
+		{
+			if (Tile.GetCellsWord(WordIndex, Mask, bValue) != 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	return Tile.Contains(FromWordIndex, ToWordIndex, Mask, bValue);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::UpdateTileSummaries(uint32 const TileIndex)
+{
+	if (Access == EAccess::Concurrent)
+	{
+		return;
+	}
+	FGridTile const & Tile = GetTile(TileIndex);
+	bool const bIsEmpty = !Tile.Contains(0, NumWordsPerTile, FullWordMask, true);
+	bool const bIsFull = !Tile.Contains(0, NumWordsPerTile, FullWordMask, false);
+	EmptyTiles.Set(TileIndex, bIsEmpty);
+	FullTiles.Set(TileIndex, bIsFull);
+	if (Storage == EStorage::Sparse && (bIsEmpty || bIsFull))
+	{
+		SetSharedTile(TileIndex, bIsEmpty ? EmptyTileSlot : FullTileSlot);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::MarkTileChanged(uint32 const TileIndex)
+{
+	// Changes of cells are visible to whoever sees the generation.
+	uint64 const Generation = LastGridLayerGeneration.fetch_add(1, std::memory_order_acq_rel) + 1;
+	if (Access == EAccess::Concurrent)
+	{
+		// No log, changes are found by scanning generations of tiles. Concurrent changes may come in any order.
+		std::atomic_ref<uint64> TileGeneration{ TileGenerations[TileIndex] };
+		uint64 OldGeneration = TileGeneration.load(std::memory_order_relaxed);
+		while (OldGeneration < Generation && !TileGeneration.compare_exchange_weak(OldGeneration, Generation, std::memory_order_relaxed))
+		{
+		}
+		return;
+	}
+	TileGenerations[TileIndex] = Generation;
+	LogTileChange(TileIndex, Generation);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::LogTileChange(uint32 const TileIndex, uint64 const Generation)
 {
-	CheckRange(Coords);
-	return GetTileByCellCoords(Coords)[GetCoordsInTile(Coords)];
+	check(Access == EAccess::Exclusive && (TileChangesLog.IsEmpty() || TileChangesLog.Last().Generation <= Generation));
+	// Dropping superseded changes keeps log no longer than twice the number of tiles.
+	if (TileChangesLog.Num() >= 2 * TileGenerations.Num())
+	{
+		TileChangesLog.RemoveAll([this](FTileChange const & Change)
+			{
+				return Change.Generation != TileGenerations[Change.TileIndex];
+			});
+	}
+	TileChangesLog.Emplace(FTileChange{ Generation, TileIndex });
 }
 
-FConstBitReference const FUEGridLayer::operator [](FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::GetChangedTiles(uint64 const SinceGeneration, TArray<uint32> & OutTileIndices) const
 {
-	CheckRange(Coords);
-	return GetTileByCellCoords(Coords)[GetCoordsInTile(Coords)];
+	if (Access == EAccess::Concurrent)
+	{
+		for (int32 TileIndex = 0; TileIndex < TileGenerations.Num(); ++TileIndex)
+		{
+			if (std::atomic_ref<uint64>(const_cast<uint64 &>(TileGenerations[TileIndex])).load(std::memory_order_relaxed) > SinceGeneration)
+			{
+				OutTileIndices.Emplace(TileIndex);
+			}
+		}
+		return;
+	}
+	int32 const FirstChangeIndex = Algo::UpperBoundBy(TileChangesLog, SinceGeneration, &FTileChange::Generation);
+	for (int32 ChangeIndex = FirstChangeIndex; ChangeIndex < TileChangesLog.Num(); ++ChangeIndex)
+	{
+		// Only the latest change of a tile is taken, so every tile is taken once.
+		FTileChange const & Change = TileChangesLog[ChangeIndex];
+		if (Change.Generation == TileGenerations[Change.TileIndex])
+		{
+			OutTileIndices.Emplace(Change.TileIndex);
+		}
+	}
 }
 
-bool FUEGridLayer::GetCell(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetSharedTile(uint32 const TileIndex, uint32 const SharedTileSlot)
 {
-	return operator [](Coords);
+	check(SharedTileSlot < SharedTilesNum);
+	uint32 & TileSlot = TileSlots[TileIndex];
+	if (TileSlot >= SharedTilesNum)
+	{
+		FreeTileSlots.Emplace(TileSlot);
+	}
+	TileSlot = SharedTileSlot;
 }
 
-bool FUEGridLayer::Contains(FUintRect const & Rect, bool const bValue) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FindFreeRectsMask(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, FRowsMask & OutMask)
 {
-	// TODO: it's ugly as fuck, rewrite it. Have no time right now.
-	if (Rect.IsEmpty())
+	check(!Layers.IsEmpty() && (RectSize.X > 0) && (RectSize.Y > 0));
+	OutMask.Origin = Rect.Min;
+	OutMask.ColumnsNum = 0;
+	OutMask.RowsNum = 0;
+	OutMask.Words.Reset();
+	if (Rect.Width() < RectSize.X || Rect.Height() < RectSize.Y)
 	{
-		return false;
+		return;
+	}
+	for (TUEGridLayer const * const Layer : Layers)
+	{
+		check(Layer && Layer->GetSize() == Layers[0]->GetSize());
+		Layer->CheckRange(Rect);
 	}
-	CheckRange(Rect);
-
-	FUintRect const TilesToCheck{ Rect.Min / FGridTile::GetSize(), (Rect.Max - FUintPoint{ 1, 1 }) / FGridTile::GetSize() };
-	uint32 const StartWordIndex = Rect.Min.X % NumWordsPerTile;
-	WordType const StartMask = FullWordMask << (Rect.Min.Y % NumBitsPerWord);
-	uint32 const EndWordIndex = ((Rect.Max.X - 1) % NumWordsPerTile) + 1;
-	WordType const EndMask = FullWordMask >> ((NumBitsPerWord - (Rect.Max.Y % NumBitsPerWord)) % NumBitsPerWord);
 
-	auto CheckColumn = [this, StartWordIndex, EndWordIndex, bValue] (uint32 const FirstTileIndex, uint32 const LastTileIndex, WordType const Mask) -> bool
-		{
-			if (GridLayerData[FirstTileIndex].Contains(StartWordIndex, NumWordsPerTile, Mask, bValue))
-			{
-				return true;
-			}
-			for (uint32 TileIndex = FirstTileIndex + 1; TileIndex < LastTileIndex; ++TileIndex)
-			{
-				if (GridLayerData[TileIndex].Contains(0, NumWordsPerTile, Mask, bValue))
-				{
-					return true;
-				}
-			}
-			return GridLayerData[LastTileIndex].Contains(0, EndWordIndex, Mask, bValue);
-		};
+	// Rows of mask are aligned with rows of tiles, so that tile words can be used as is.
+	uint32 const FromTileY = Rect.Min.Y / NumBitsPerWord;
+	uint32 const ToTileY = (Rect.Max.Y - 1) / NumBitsPerWord + 1;
+	uint32 const ColumnsNum = Rect.Width();
+	uint32 const RowsNum = ToTileY - FromTileY;
+	OutMask.Origin = FUintPoint{ Rect.Min.X, FromTileY * NumBitsPerWord };
+	OutMask.ColumnsNum = ColumnsNum;
+	OutMask.RowsNum = RowsNum;
+	OutMask.Words.SetNumUninitialized(ColumnsNum * RowsNum);
+	WordType * const Words = OutMask.Words.GetData();
 
-	if (TilesToCheck.Width() == 0)
+	// Cells of Rect free in all layers.
+	for (uint32 RowIndex = 0; RowIndex < RowsNum; ++RowIndex)
 	{
-		if (TilesToCheck.Height() == 0)
+		uint32 const TileY = FromTileY + RowIndex;
+		WordType RowMask = FullWordMask;
+		if (TileY == FromTileY)
 		{
-			return GetTile(TilesToCheck.Min).Contains(StartWordIndex, EndWordIndex, StartMask & EndMask, bValue);
+			RowMask &= FullWordMask << (Rect.Min.Y % NumBitsPerWord);
 		}
-		else
+		if (TileY == ToTileY - 1)
 		{
-			uint32 const FirstTileIndex = GetTileIndex(TilesToCheck.Min);
-			uint32 const LastTileIndex = GetTileIndex(TilesToCheck.Max);
-			if (GridLayerData[FirstTileIndex].Contains(StartWordIndex, EndWordIndex, StartMask, bValue))
-			{
-				return true;
-			}
-			for (uint32 TileIndex = FirstTileIndex + GetXTileNum(); TileIndex < LastTileIndex; TileIndex += GetXTileNum())
-			{
-				if (GridLayerData[TileIndex].Contains(StartWordIndex, EndWordIndex, FullWordMask, bValue))
-				{
-					return true;
-				}
-			}
-			return GridLayerData[LastTileIndex].Contains(StartWordIndex, EndWordIndex, EndMask, bValue);
+			RowMask &= FullWordMask >> ((NumBitsPerWord - (Rect.Max.Y % NumBitsPerWord)) % NumBitsPerWord);
 		}
-	}
-	else
-	{
-		if (TilesToCheck.Height() == 0)
+		WordType * const RowWords = Words + RowIndex * ColumnsNum;
+		for (uint32 ColumnIndex = 0; ColumnIndex < ColumnsNum; ++ColumnIndex)
 		{
-			uint32 const FirstTileIndex = GetTileIndex(TilesToCheck.Min);
-			uint32 const LastTileIndex = GetTileIndex(TilesToCheck.Max);
-			return CheckColumn(FirstTileIndex, LastTileIndex, StartMask & EndMask);
+			RowWords[ColumnIndex] = RowMask;
 		}
-		else
+		for (TUEGridLayer const * const Layer : Layers)
 		{
-			// Checking first column.
-			{
-				uint32 const FirstTileIndex = GetTileIndex(TilesToCheck.Min);
-				uint32 const LastTileIndex = GetTileIndex(FUintPoint{ TilesToCheck.Max.X, TilesToCheck.Min.Y });
-				if (CheckColumn(FirstTileIndex, LastTileIndex, StartMask))
-				{
-					return true;
-				}
-			}
-
-			// Checking internal columns.
+			for (uint32 ColumnIndex = 0; ColumnIndex < ColumnsNum; ++ColumnIndex)
 			{
-				uint32 const InnerXTilesNum = TilesToCheck.Width() - 1;
-				uint32 const FirstColumnTileIndex = GetTileIndex(FUintPoint{ TilesToCheck.Min.X, TilesToCheck.Min.Y + 1 });
-				uint32 const LastColumnTileIndex = GetTileIndex(FUintPoint{ TilesToCheck.Min.X, TilesToCheck.Max.Y });
-				BYTE const Test = bValue ? 0u : ~0u;
-				for (uint32 ColumnTileIndex = FirstColumnTileIndex; ColumnTileIndex < LastColumnTileIndex; ColumnTileIndex += GetXTileNum())
+				uint32 const X = Rect.Min.X + ColumnIndex;
+				uint32 const TileIndex = Layer->GetTileIndex(FUintPoint{ X / NumWordsPerTile, TileY });
+				if (!Layer->EmptyTiles.Get(TileIndex))
 				{
-					if (GridLayerData[ColumnTileIndex].Contains(StartWordIndex, NumWordsPerTile, FullWordMask, bValue))
-					{
-						return true;
-					}
-					void const * const Start = static_cast<void const *>(GridLayerData.GetData() + ColumnTileIndex + 1);
-					void const * const End = static_cast<void const *>(GridLayerData.GetData() + ColumnTileIndex + 1 + InnerXTilesNum);
-					for (BYTE const * Byte = static_cast<BYTE const *>(Start); Byte < End; ++Byte)
-					{
-						if (*Byte != Test)
-						{
-							return true;
-						}
-					}
-					if (GridLayerData[ColumnTileIndex + 1 + InnerXTilesNum].Contains(0, EndWordIndex, FullWordMask, bValue))
-					{
-						return true;
-					}
+					bool const bValue = false;
+					RowWords[ColumnIndex] &= Layer->GetTile(TileIndex).GetCellsWord(X % NumWordsPerTile, FullWordMask, bValue);
 				}
 			}
-
-			// Checking last column.
-			{
-				uint32 const FirstTileIndex = GetTileIndex(FUintPoint{ TilesToCheck.Min.X, TilesToCheck.Max.Y });
-				uint32 const LastTileIndex = GetTileIndex(TilesToCheck.Max);
-				return CheckColumn(FirstTileIndex, LastTileIndex, EndMask);
-			}
 		}
 	}
+
+	ApplyBoxToRowsMask(OutMask, RectSize, EUEGridLayerOperation::And);
 }
 
-void FUEGridLayer::SetCells(FUintRect const & Rect, bool const bValue)
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::ApplyBoxToRowsMask(FRowsMask & Mask, FUintPoint const BoxSize, EUEGridLayerOperation const Operation)
 {
-	if (Rect.IsEmpty())
-	{
-		return;
-	}
-	CheckRange(Rect);
-
-	FUintRect const TilesToSet{ Rect.Min / FGridTile::GetSize(), (Rect.Max - FUintPoint{ 1, 1 }) / FGridTile::GetSize() };
-	uint32 const StartWordIndex = Rect.Min.X % NumWordsPerTile;
-	WordType const StartMask = FullWordMask << (Rect.Min.Y % NumBitsPerWord);
-	uint32 const EndWordIndex = ((Rect.Max.X - 1) % NumWordsPerTile) + 1;
-	WordType const EndMask = FullWordMask >> ((NumBitsPerWord - (Rect.Max.Y % NumBitsPerWord)) % NumBitsPerWord);
+	check((Operation == EUEGridLayerOperation::And) || (Operation == EUEGridLayerOperation::Or));
+	uint32 const ColumnsNum = Mask.ColumnsNum;
+	uint32 const RowsNum = Mask.RowsNum;
+	WordType * const Words = Mask.Words.GetData();
+	// Unset bits from outside of mask clear bits for And and keep them for Or.
+	bool const bIsAnd = Operation == EUEGridLayerOperation::And;
 
-	auto SetColumn = [this, StartWordIndex, EndWordIndex, bValue] (uint32 const FirstTileIndex, uint32 const LastTileIndex, WordType const Mask)
+	// Along Y: bit gets combination of BoxSize.Y bits starting from it.
+	for (uint32 CombinedSize = 1; CombinedSize < BoxSize.Y;)
+	{
+		uint32 const Shift = FMath::Min(CombinedSize, BoxSize.Y - CombinedSize);
+		uint32 const RowsShift = Shift / NumBitsPerWord;
+		uint32 const BitsShift = Shift % NumBitsPerWord;
+		for (uint32 RowIndex = 0; RowIndex < RowsNum; ++RowIndex)
 		{
-			GridLayerData[FirstTileIndex].SetCells(StartWordIndex, NumWordsPerTile, Mask, bValue);
-			for (uint32 TileIndex = FirstTileIndex + 1; TileIndex < LastTileIndex; ++TileIndex)
+			// Rows are processed in ascending order, so shifted rows are not changed yet.
+			WordType * const RowWords = Words + RowIndex * ColumnsNum;
+			if (RowIndex + RowsShift >= RowsNum)
 			{
-				GridLayerData[TileIndex].SetCells(0, NumWordsPerTile, Mask, bValue);
+				if (bIsAnd)
+				{
+					FMemory::Memzero(RowWords, ColumnsNum * sizeof(WordType));
+				}
+				continue;
 			}
-			GridLayerData[LastTileIndex].SetCells(0, EndWordIndex, Mask, bValue);
-		};
-
-	if (TilesToSet.Width() == 0)
-	{
-		if (TilesToSet.Height() == 0)
-		{
-			GetTile(TilesToSet.Min).SetCells(StartWordIndex, EndWordIndex, StartMask & EndMask, bValue);
-		}
-		else
-		{
-			uint32 const FirstTileIndex = GetTileIndex(TilesToSet.Min);
-			uint32 const LastTileIndex = GetTileIndex(TilesToSet.Max);
-			GridLayerData[FirstTileIndex].SetCells(StartWordIndex, EndWordIndex, StartMask, bValue);
-			for (uint32 TileIndex = FirstTileIndex + GetXTileNum(); TileIndex < LastTileIndex; TileIndex += GetXTileNum())
+			WordType const * const LowRowWords = Words + (RowIndex + RowsShift) * ColumnsNum;
+			if (BitsShift == 0)
 			{
-				GridLayerData[TileIndex].SetCells(StartWordIndex, EndWordIndex, FullWordMask, bValue);
+				for (uint32 ColumnIndex = 0; ColumnIndex < ColumnsNum; ++ColumnIndex)
+				{
+					RowWords[ColumnIndex] = CombineWords(RowWords[ColumnIndex], LowRowWords[ColumnIndex], Operation);
+				}
 			}
-			GridLayerData[LastTileIndex].SetCells(StartWordIndex, EndWordIndex, EndMask, bValue);
-		}
-	}
-	else
-	{
-		if (TilesToSet.Height() == 0)
-		{
-			uint32 const FirstTileIndex = GetTileIndex(TilesToSet.Min);
-			uint32 const LastTileIndex = GetTileIndex(TilesToSet.Max);
-			SetColumn(FirstTileIndex, LastTileIndex, StartMask & EndMask);
-		}
-		else
-		{
-			// Setting first column.
+			else if (RowIndex + RowsShift + 1 < RowsNum)
 			{
-				uint32 const FirstTileIndex = GetTileIndex(TilesToSet.Min);
-				uint32 const LastTileIndex = GetTileIndex(FUintPoint{ TilesToSet.Max.X, TilesToSet.Min.Y });
-				SetColumn(FirstTileIndex, LastTileIndex, StartMask);
+				WordType const * const HighRowWords = LowRowWords + ColumnsNum;
+				for (uint32 ColumnIndex = 0; ColumnIndex < ColumnsNum; ++ColumnIndex)
+				{
+					WordType const ShiftedWord = (LowRowWords[ColumnIndex] >> BitsShift) | (HighRowWords[ColumnIndex] << (NumBitsPerWord - BitsShift));
+					RowWords[ColumnIndex] = CombineWords(RowWords[ColumnIndex], ShiftedWord, Operation);
+				}
 			}
-
-			// Setting internal columns.
+			else
 			{
-				uint32 const InnerXTilesNum = TilesToSet.Width() - 1;
-				uint32 const FirstColumnTileIndex = GetTileIndex(FUintPoint{ TilesToSet.Min.X, TilesToSet.Min.Y + 1 });
-				uint32 const LastColumnTileIndex = GetTileIndex(FUintPoint{ TilesToSet.Min.X, TilesToSet.Max.Y });
-				for (uint32 ColumnTileIndex = FirstColumnTileIndex; ColumnTileIndex < LastColumnTileIndex; ColumnTileIndex += GetXTileNum())
+				for (uint32 ColumnIndex = 0; ColumnIndex < ColumnsNum; ++ColumnIndex)
 				{
-					GridLayerData[ColumnTileIndex].SetCells(StartWordIndex, NumWordsPerTile, FullWordMask, bValue);
-					// Set fully covered tiles.
-					FMemory::Memset(GridLayerData.GetData() + ColumnTileIndex + 1, (bValue ? 0xff : 0), InnerXTilesNum * sizeof(FGridTile));
-					GridLayerData[ColumnTileIndex + 1 + InnerXTilesNum].SetCells(0, EndWordIndex, FullWordMask, bValue);
+					RowWords[ColumnIndex] = CombineWords(RowWords[ColumnIndex], LowRowWords[ColumnIndex] >> BitsShift, Operation);
 				}
 			}
+		}
+		CombinedSize += Shift;
+	}
 
-			// Setting last column.
+	// Along X: word gets combination of BoxSize.X words starting from it.
+	for (uint32 CombinedSize = 1; CombinedSize < BoxSize.X;)
+	{
+		uint32 const Shift = FMath::Min(CombinedSize, BoxSize.X - CombinedSize);
+		uint32 const CombinedColumnsNum = ColumnsNum > Shift ? ColumnsNum - Shift : 0;
+		for (uint32 RowIndex = 0; RowIndex < RowsNum; ++RowIndex)
+		{
+			WordType * const RowWords = Words + RowIndex * ColumnsNum;
+			for (uint32 ColumnIndex = 0; ColumnIndex < CombinedColumnsNum; ++ColumnIndex)
+			{
+				RowWords[ColumnIndex] = CombineWords(RowWords[ColumnIndex], RowWords[ColumnIndex + Shift], Operation);
+			}
+			if (bIsAnd)
 			{
-				uint32 const FirstTileIndex = GetTileIndex(FUintPoint{ TilesToSet.Min.X, TilesToSet.Max.Y });
-				uint32 const LastTileIndex = GetTileIndex(TilesToSet.Max);
-				SetColumn(FirstTileIndex, LastTileIndex, EndMask);
+				FMemory::Memzero(RowWords + CombinedColumnsNum, (ColumnsNum - CombinedColumnsNum) * sizeof(WordType));
 			}
 		}
+		CombinedSize += Shift;
 	}
 }
 
-FUintPoint FUEGridLayer::GetSize() const
-{
-	return Size;
-}
-
-uint32 FUEGridLayer::GetXSize() const
+template <typename InWordType, uint32 InNumWordsPerTile>
+FUintPoint TUEGridLayer<InWordType, InNumWordsPerTile>::GetCoordsInTile(FUintPoint const Coords) const
 {
-	return Size.X;
+	return FUintPoint{ Coords.X % NumWordsPerTile, Coords.Y % NumBitsPerWord };
 }
 
-uint32 FUEGridLayer::GetYSize() const
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile const & TUEGridLayer<InWordType, InNumWordsPerTile>::GetTile(uint32 const TileIndex) const
 {
-	return Size.Y;
+	return GridLayerData[TileSlots[TileIndex]];
 }
 
-FUintPoint FUEGridLayer::GetCoordsInTile(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile & TUEGridLayer<InWordType, InNumWordsPerTile>::GetMutableTile(uint32 const TileIndex)
 {
-	return FUintPoint{ Coords.X % NumWordsPerTile, Coords.Y % NumBitsPerWord };
+	uint32 & TileSlot = TileSlots[TileIndex];
+	if (TileSlot < SharedTilesNum)
+	{
+		check(Storage == EStorage::Sparse);
+		// Copy first, GridLayerData may be reallocated.
+		FGridTile const SharedTile = GridLayerData[TileSlot];
+		if (FreeTileSlots.IsEmpty())
+		{
+			TileSlot = GridLayerData.Emplace(SharedTile);
+		}
+		else
+		{
+			TileSlot = FreeTileSlots.Pop();
+			GridLayerData[TileSlot] = SharedTile;
+		}
+	}
+	return GridLayerData[TileSlot];
 }
 
-FUEGridLayer::FGridTile const & FUEGridLayer::GetTile(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile const & TUEGridLayer<InWordType, InNumWordsPerTile>::GetTile(FUintPoint const Coords) const
 {
-	return GridLayerData[GetTileIndex(Coords)];
+	return GetTile(GetTileIndex(Coords));
 }
 
-FUEGridLayer::FGridTile & FUEGridLayer::GetTile(FUintPoint const Coords)
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile & TUEGridLayer<InWordType, InNumWordsPerTile>::GetTile(FUintPoint const Coords)
 {
-	return const_cast<FGridTile &>(static_cast<FUEGridLayer const &>(*this).GetTile(Coords)); // Hate Scott Meyers, btw.
+	return GetMutableTile(GetTileIndex(Coords));
 }
 
-FUEGridLayer::FGridTile const & FUEGridLayer::GetTileByCellCoords(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile const & TUEGridLayer<InWordType, InNumWordsPerTile>::GetTileByCellCoords(FUintPoint const Coords) const
 {
 	CheckRange(Coords);
 	uint32 const TileX = Coords.X / NumWordsPerTile;
@@ -258,75 +1346,278 @@ FUEGridLayer::FGridTile const & FUEGridLayer::GetTileByCellCoords(FUintPoint con
 	return GetTile(FUintPoint{ TileX, TileY });
 }
 
-FUEGridLayer::FGridTile & FUEGridLayer::GetTileByCellCoords(FUintPoint const Coords)
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile & TUEGridLayer<InWordType, InNumWordsPerTile>::GetTileByCellCoords(FUintPoint const Coords)
 {
-	return const_cast<FGridTile &>(static_cast<FUEGridLayer const &>(*this).GetTileByCellCoords(Coords)); // Hate Scott Meyers, btw.
+	CheckRange(Coords);
+	return GetTile(Coords / FGridTile::GetSize());
 }
 
-uint32 FUEGridLayer::GetTileIndex(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetTileIndex(FUintPoint const Coords) const
 {
 	return Coords.Y * GetXTileNum() + Coords.X;
 }
 
-FUintPoint FUEGridLayer::GetTileNum() const
+template <typename InWordType, uint32 InNumWordsPerTile>
+FUintPoint TUEGridLayer<InWordType, InNumWordsPerTile>::GetTileNum() const
 {
 	return FUintPoint{ GetXTileNum(), GetYTileNum() };
 }
 
-uint32 FUEGridLayer::GetXTileNum() const
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetXTileNum() const
 {
 	return GetXSize() / NumWordsPerTile;
 }
 
-uint32 FUEGridLayer::GetYTileNum() const
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::GetYTileNum() const
 {
 	return GetYSize() / NumBitsPerWord;
 }
 
-void FUEGridLayer::CheckRange(FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::CheckRange(FUintPoint const Coords) const
 {
 	check((Coords.X < GetXSize()) && (Coords.Y < GetYSize()));
 }
 
-void FUEGridLayer::CheckRange(FUintRect const & Rect) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::CheckRange(FUintRect const & Rect) const
 {
 	CheckRange(Rect.Min);
 	CheckRange(Rect.IsEmpty() ? Rect.Max : Rect.Max - FUintPoint{ 1, 1 });
 	check(Rect.Min.X <= Rect.Max.X && Rect.Min.Y <= Rect.Max.Y);
 }
 
-void FUEGridLayer::SetSize(FUintPoint const NewSize)
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::SetSize(FUintPoint const NewSize)
 {
 	check((NewSize.X <= MAX_uint32 - (NumWordsPerTile - 1)) && (NewSize.Y <= MAX_uint32 - (NumBitsPerWord - 1)));
 	Size = FUintPoint{ ((NewSize.X + (NumWordsPerTile - 1)) / NumWordsPerTile) * NumWordsPerTile, ((NewSize.Y + (NumBitsPerWord - 1)) / NumBitsPerWord) * NumBitsPerWord };
+	uint32 const TilesNum = GetXTileNum() * GetYTileNum();
+	TileSlots.Empty(TilesNum);
+	for (uint32 TileIndex = 0; TileIndex < TilesNum; ++TileIndex)
+	{
+		TileSlots.Emplace(Storage == EStorage::Sparse ? EmptyTileSlot : SharedTilesNum + TileIndex);
+	}
+	if (Storage == EStorage::Dense && TileOrder == ETileOrder::Morton)
+	{
+		uint32 NextTileSlot = SharedTilesNum;
+		auto AssignTileSlot = [this, &NextTileSlot](FUintPoint const TileCoords) -> bool
+			{
+				TileSlots[GetTileIndex(TileCoords)] = NextTileSlot++;
+				return true;
+			};
+		VisitTilesInMortonOrder(FUintRect{ FUintPoint{ 0, 0 }, GetTileNum() }, FUintPoint{ 0, 0 }, GetMortonBlockSize(), AssignTileSlot);
+	}
 	GridLayerData.Empty();
-	GridLayerData.SetNumZeroed(GetXTileNum() * GetYTileNum());
+	GridLayerData.SetNumZeroed(SharedTilesNum + (Storage == EStorage::Sparse ? 0 : TilesNum));
+	FMemory::Memset(&GridLayerData[FullTileSlot], 0xff, sizeof(FGridTile));
+	FreeTileSlots.Empty();
+	// All tiles are mixed for concurrent layer, as it does not keep summaries.
+	EmptyTiles.Init(TilesNum, Access == EAccess::Exclusive);
+	FullTiles.Init(TilesNum, false);
+	RowLocks.SetNum(Access == EAccess::Concurrent ? NumRowLockStripes : 0);
+	SizeGeneration = LastGridLayerGeneration.fetch_add(1, std::memory_order_acq_rel) + 1;
+	TileGenerations.Init(SizeGeneration, TilesNum);
+	TileChangesLog.Empty();
 }
 
-FUEGridLayer::FGridTile::FGridTile(FGridTile const & GridTile) noexcept
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FCellReference::FCellReference(TUEGridLayer & InGridLayer, FUintPoint const InCoords)
+	: GridLayer(InGridLayer)
+	, Coords(InCoords)
 {
-	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FCellReference::operator bool() const
+{
+	return GridLayer.GetCell(Coords);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FCellReference & TUEGridLayer<InWordType, InNumWordsPerTile>::FCellReference::operator =(bool const bValue)
+{
+	GridLayer.SetCell(Coords, bValue);
+	return *this;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FScopedRowsLock::FScopedRowsLock(TUEGridLayer const & InGridLayer, FUintRect const & Rect, FRWScopeLockType const InLockType)
+	: GridLayer(InGridLayer)
+	, StripesMask(0)
+	, LockType(InLockType)
+{
+	if (GridLayer.RowLocks.IsEmpty() || Rect.IsEmpty())
 	{
-		GridCells[WordIndex] = GridTile.GridCells[WordIndex];
+		return;
+	}
+	GridLayer.CheckRange(Rect);
+	uint32 const FromTileY = Rect.Min.Y / NumBitsPerWord;
+	uint32 const ToTileY = (Rect.Max.Y - 1) / NumBitsPerWord + 1;
+	for (uint32 TileY = FromTileY; TileY < FMath::Min(ToTileY, FromTileY + NumRowLockStripes); ++TileY)
+	{
+		StripesMask |= uint64{ 1 } << (TileY % NumRowLockStripes);
+	}
+	for (uint64 Mask = StripesMask; Mask != 0; Mask &= Mask - 1)
+	{
+		FRWLock & Lock = GridLayer.RowLocks[FMath::CountTrailingZeros64(Mask)].Lock;
+		if (LockType == SLT_Write)
+		{
+			Lock.WriteLock();
+		}
+		else
+		{
+			Lock.ReadLock();
+		}
 	}
 }
 
-FBitReference FUEGridLayer::FGridTile::operator [](FUintPoint const Coords)
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FScopedRowsLock::~FScopedRowsLock()
 {
-	CheckRange(Coords);
-	return FBitReference(GridCells[Coords.X], 1 << Coords.Y);
+	for (uint64 Mask = StripesMask; Mask != 0; Mask &= Mask - 1)
+	{
+		FRWLock & Lock = GridLayer.RowLocks[FMath::CountTrailingZeros64(Mask)].Lock;
+		if (LockType == SLT_Write)
+		{
+			Lock.WriteUnlock();
+		}
+		else
+		{
+			Lock.ReadUnlock();
+		}
+	}
 }
 
-FConstBitReference const FUEGridLayer::FGridTile::operator [](FUintPoint const Coords) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FRowsLock::FRowsLock(FRowsLock const &)
 {
-	CheckRange(Coords);
-	return FConstBitReference(GridCells[Coords.X], 1 << Coords.Y);
 }
 
-bool FUEGridLayer::FGridTile::Contains(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::FRowsLock & TUEGridLayer<InWordType, InNumWordsPerTile>::FRowsLock::operator =(FRowsLock const &)
+{
+	return *this;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::Init(uint32 const TilesNum, bool const bValue)
+{
+	SummaryData.Init(bValue ? ~SummaryWordType{ 0 } : SummaryWordType{ 0 }, FMath::DivideAndRoundUp(TilesNum, NumBitsPerSummaryWord));
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::Get(uint32 const TileIndex) const
+{
+	return (SummaryData[TileIndex / NumBitsPerSummaryWord] >> (TileIndex % NumBitsPerSummaryWord)) & 1;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::Set(uint32 const TileIndex, bool const bValue)
+{
+	SummaryWordType const Mask = SummaryWordType{ 1 } << (TileIndex % NumBitsPerSummaryWord);
+	SummaryWordType & SummaryWord = SummaryData[TileIndex / NumBitsPerSummaryWord];
+	SummaryWord = bValue ? (SummaryWord | Mask) : (SummaryWord & ~Mask);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::SetRange(uint32 const FromTileIndex, uint32 const TilesNum, bool const bValue)
+{
+	uint32 const ToTileIndex = FromTileIndex + TilesNum;
+	for (uint32 TileIndex = FromTileIndex; TileIndex < ToTileIndex;)
+	{
+		uint32 const BitIndex = TileIndex % NumBitsPerSummaryWord;
+		uint32 const BitsNum = FMath::Min(NumBitsPerSummaryWord - BitIndex, ToTileIndex - TileIndex);
+		SummaryWordType const Mask = (~SummaryWordType{ 0 } >> (NumBitsPerSummaryWord - BitsNum)) << BitIndex;
+		SummaryWordType & SummaryWord = SummaryData[TileIndex / NumBitsPerSummaryWord];
+		SummaryWord = bValue ? (SummaryWord | Mask) : (SummaryWord & ~Mask);
+		TileIndex += BitsNum;
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::AreAllSet(uint32 const FromTileIndex, uint32 const TilesNum) const
+{
+	uint32 const ToTileIndex = FromTileIndex + TilesNum;
+	for (uint32 TileIndex = FromTileIndex; TileIndex < ToTileIndex;)
+	{
+		uint32 const BitIndex = TileIndex % NumBitsPerSummaryWord;
+		uint32 const BitsNum = FMath::Min(NumBitsPerSummaryWord - BitIndex, ToTileIndex - TileIndex);
+		SummaryWordType const Mask = (~SummaryWordType{ 0 } >> (NumBitsPerSummaryWord - BitsNum)) << BitIndex;
+		if ((SummaryData[TileIndex / NumBitsPerSummaryWord] & Mask) != Mask)
+		{
+			return false;
+		}
+		TileIndex += BitsNum;
+	}
+	return true;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+SIZE_T TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::GetAllocatedSize() const
+{
+	return SummaryData.GetAllocatedSize();
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSummary::Serialize(FArchive & Ar, uint32 const TilesNum)
+{
+	Ar << SummaryData;
+	int32 const SummaryWordsNum = FMath::DivideAndRoundUp(TilesNum, NumBitsPerSummaryWord);
+	if (Ar.IsLoading() && SummaryData.Num() != SummaryWordsNum)
+	{
+		Ar.SetError();
+		SummaryData.SetNumZeroed(SummaryWordsNum);
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FTileSpan::CoversWholeTiles() const
+{
+	return FromWordIndex == 0 && ToWordIndex == NumWordsPerTile && Mask == FullWordMask;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::FGridTile(FGridTile const & GridTile) noexcept
+{
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+	{
+		GridCells[WordIndex] = GridTile.GridCells[WordIndex];
+	}
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::Contains(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const
 {
 	check((FromWordIndex <= ToWordIndex) && (ToWordIndex <= NumWordsPerTile));
-	WordType const Test = bValue ? 0u : ~0u;
+#if UE_GRID_LAYER_WITH_AVX2
+	static_assert(NumWordsPerTile % NumWordsPerAVX2Register<WordType> == 0);
+	__m256i const VectorTest = _mm256_set1_epi32(bValue ? 0 : -1);
+	__m256i Accumulator = _mm256_setzero_si256();
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerAVX2Register<WordType>)
+	{
+		__m256i const Cells = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(GridCells + WordIndex));
+		__m256i const WordsMask = GetAVX2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		Accumulator = _mm256_or_si256(Accumulator, _mm256_and_si256(_mm256_xor_si256(Cells, VectorTest), WordsMask));
+	}
+	return !_mm256_testz_si256(Accumulator, Accumulator);
+#elif UE_GRID_LAYER_WITH_SSE2
+	static_assert(NumWordsPerTile % NumWordsPerSSE2Register<WordType> == 0);
+	__m128i const VectorTest = _mm_set1_epi32(bValue ? 0 : -1);
+	__m128i Accumulator = _mm_setzero_si128();
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerSSE2Register<WordType>)
+	{
+		__m128i const Cells = _mm_loadu_si128(reinterpret_cast<__m128i const *>(GridCells + WordIndex));
+		__m128i const WordsMask = GetSSE2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		Accumulator = _mm_or_si128(Accumulator, _mm_and_si128(_mm_xor_si128(Cells, VectorTest), WordsMask));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(Accumulator, _mm_setzero_si128())) != 0xffff;
+#else
+	WordType const Test = bValue ? WordType{ 0 } : FullWordMask;
 	for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
 	{
 		if ((GridCells[WordIndex] & Mask) != (Test & Mask))
@@ -335,11 +1626,30 @@ bool FUEGridLayer::FGridTile::Contains(uint32 const FromWordIndex, uint32 const
 		}
 	}
 	return false;
+#endif
 }
 
-void FUEGridLayer::FGridTile::SetCells(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue)
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::SetCells(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue)
 {
 	check((FromWordIndex <= ToWordIndex) && (ToWordIndex <= NumWordsPerTile));
+#if UE_GRID_LAYER_WITH_AVX2
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerAVX2Register<WordType>)
+	{
+		__m256i * const CellsPtr = reinterpret_cast<__m256i *>(GridCells + WordIndex);
+		__m256i const Cells = _mm256_loadu_si256(CellsPtr);
+		__m256i const WordsMask = GetAVX2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		_mm256_storeu_si256(CellsPtr, bValue ? _mm256_or_si256(Cells, WordsMask) : _mm256_andnot_si256(WordsMask, Cells));
+	}
+#elif UE_GRID_LAYER_WITH_SSE2
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerSSE2Register<WordType>)
+	{
+		__m128i * const CellsPtr = reinterpret_cast<__m128i *>(GridCells + WordIndex);
+		__m128i const Cells = _mm_loadu_si128(CellsPtr);
+		__m128i const WordsMask = GetSSE2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		_mm_storeu_si128(CellsPtr, bValue ? _mm_or_si128(Cells, WordsMask) : _mm_andnot_si128(WordsMask, Cells));
+	}
+#else
 	if (bValue)
 	{
 		for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
@@ -354,24 +1664,127 @@ void FUEGridLayer::FGridTile::SetCells(uint32 const FromWordIndex, uint32 const
 			GridCells[WordIndex] &= ~Mask;
 		}
 	}
+#endif
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::SetCellsAtomically(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue)
+{
+	check((FromWordIndex <= ToWordIndex) && (ToWordIndex <= NumWordsPerTile));
+	WordType ChangedCells = 0;
+	for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
+	{
+		std::atomic_ref<WordType> Word{ GridCells[WordIndex] };
+		WordType const OldWord = bValue ? Word.fetch_or(Mask, std::memory_order_relaxed) : Word.fetch_and(~Mask, std::memory_order_relaxed);
+		ChangedCells |= (bValue ? ~OldWord : OldWord) & Mask;
+	}
+	return ChangedCells != 0;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+bool TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::SetCellsWordAtomically(uint32 const WordIndex, WordType const Mask, WordType const Cells)
+{
+	check(WordIndex < NumWordsPerTile);
+	// Cells to set and cells to clear don't overlap, so every cell changes at most once and cells outside of Mask are kept.
+	WordType const CellsToSet = Cells & Mask;
+	WordType const CellsToClear = ~Cells & Mask;
+	std::atomic_ref<WordType> Word{ GridCells[WordIndex] };
+	WordType const OldWord = Word.fetch_or(CellsToSet, std::memory_order_relaxed);
+	WordType const SetWord = Word.fetch_and(~CellsToClear, std::memory_order_relaxed);
+	return ((~OldWord & CellsToSet) | (SetWord & CellsToClear)) != 0;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::SetCellsCombined(FGridTile const & TileA, FGridTile const & TileB, EUEGridLayerOperation const Operation, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask)
+{
+	check((FromWordIndex <= ToWordIndex) && (ToWordIndex <= NumWordsPerTile));
+#if UE_GRID_LAYER_WITH_AVX2
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerAVX2Register<WordType>)
+	{
+		__m256i * const CellsPtr = reinterpret_cast<__m256i *>(GridCells + WordIndex);
+		__m256i const CellsA = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(TileA.GridCells + WordIndex));
+		__m256i const CellsB = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(TileB.GridCells + WordIndex));
+		__m256i const Cells = _mm256_loadu_si256(CellsPtr);
+		__m256i const WordsMask = GetAVX2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		__m256i const CombinedCells = _mm256_and_si256(CombineAVX2Words(CellsA, CellsB, Operation), WordsMask);
+		_mm256_storeu_si256(CellsPtr, _mm256_or_si256(_mm256_andnot_si256(WordsMask, Cells), CombinedCells));
+	}
+#elif UE_GRID_LAYER_WITH_SSE2
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; WordIndex += NumWordsPerSSE2Register<WordType>)
+	{
+		__m128i * const CellsPtr = reinterpret_cast<__m128i *>(GridCells + WordIndex);
+		__m128i const CellsA = _mm_loadu_si128(reinterpret_cast<__m128i const *>(TileA.GridCells + WordIndex));
+		__m128i const CellsB = _mm_loadu_si128(reinterpret_cast<__m128i const *>(TileB.GridCells + WordIndex));
+		__m128i const Cells = _mm_loadu_si128(CellsPtr);
+		__m128i const WordsMask = GetSSE2WordsMask(WordIndex, FromWordIndex, ToWordIndex, Mask);
+		__m128i const CombinedCells = _mm_and_si128(CombineSSE2Words(CellsA, CellsB, Operation), WordsMask);
+		_mm_storeu_si128(CellsPtr, _mm_or_si128(_mm_andnot_si128(WordsMask, Cells), CombinedCells));
+	}
+#else
+	for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
+	{
+		WordType const CombinedCells = CombineWords(TileA.GridCells[WordIndex], TileB.GridCells[WordIndex], Operation) & Mask;
+		GridCells[WordIndex] = (GridCells[WordIndex] & ~Mask) | CombinedCells;
+	}
+#endif
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::CountCells(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const
+{
+	check((FromWordIndex <= ToWordIndex) && (ToWordIndex <= NumWordsPerTile));
+	uint32 CellsNum = 0;
+	for (uint32 WordIndex = FromWordIndex; WordIndex < ToWordIndex; ++WordIndex)
+	{
+		CellsNum += FMath::CountBits(GetCellsWord(WordIndex, Mask, bValue));
+	}
+	return CellsNum;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+typename TUEGridLayer<InWordType, InNumWordsPerTile>::WordType TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::GetCellsWord(uint32 const WordIndex, WordType const Mask, bool const bValue) const
+{
+	check(WordIndex < NumWordsPerTile);
+	WordType const Word = std::atomic_ref<WordType>(const_cast<WordType &>(GridCells[WordIndex])).load(std::memory_order_relaxed);
+	return (bValue ? Word : ~Word) & Mask;
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::SetCellsWord(uint32 const WordIndex, WordType const Word)
+{
+	check(WordIndex < NumWordsPerTile);
+	std::atomic_ref<WordType>(GridCells[WordIndex]).store(Word, std::memory_order_relaxed);
+}
+
+template <typename InWordType, uint32 InNumWordsPerTile>
+void TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::Serialize(FArchive & Ar)
+{
+	for (uint32 WordIndex = 0; WordIndex < NumWordsPerTile; ++WordIndex)
+	{
+		Ar << GridCells[WordIndex];
+	}
 }
 
-FUintPoint FUEGridLayer::FGridTile::GetSize()
+template <typename InWordType, uint32 InNumWordsPerTile>
+FUintPoint TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::GetSize()
 {
 	return FUintPoint{ GetXSize(), GetYSize() };
 }
 
-uint32 FUEGridLayer::FGridTile::GetXSize()
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::GetXSize()
 {
 	return NumWordsPerTile;
 }
 
-uint32 FUEGridLayer::FGridTile::GetYSize()
+template <typename InWordType, uint32 InNumWordsPerTile>
+uint32 TUEGridLayer<InWordType, InNumWordsPerTile>::FGridTile::GetYSize()
 {
 	return NumBitsPerWord;
 }
 
-void FUEGridLayer::FGridTile::CheckRange(FUintPoint const Coords) const
-{
-	check((Coords.X < GetXSize()) && (Coords.Y < GetYSize()));
-}
+template class TUEGridLayer<uint32, 8>;
+template class TUEGridLayer<uint32, 16>;
+template class TUEGridLayer<uint32, 32>;
+template class TUEGridLayer<uint64, 8>;
+template class TUEGridLayer<uint64, 16>;
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Grid/UEGridRectsIndex.h"
+#include "Algo/Sort.h"
+
+void FUEGridRectsIndex::Build(TConstArrayView<FIntRect> const InRects)
+{
+	Rects.Reset();
+	Rects.Append(InRects.GetData(), InRects.Num());
+	Bounds = FIntRect{};
+	IndexCellSizeLog2 = 0;
+	IndexCellsNum = FIntPoint::ZeroValue;
+	IndexCellStarts.Reset();
+	RectIndices.Reset();
+
+	bool bHasBounds = false;
+	for (FIntRect const & Rect : Rects)
+	{
+		if (Rect.Width() > 0 && Rect.Height() > 0)
+		{
+			if (bHasBounds)
+			{
+				Bounds.Union(Rect);
+			}
+			else
+			{
+				Bounds = Rect;
+				bHasBounds = true;
+			}
+		}
+	}
+	if (!bHasBounds)
+	{
+		return;
+	}
+
+	// The smallest index cell keeping number of index cells proportional to number of rects.
+	int64 const MaxIndexCellsNum = FMath::Max(MinMaxIndexCellsNum, MaxIndexCellsPerRectNum * Rects.Num());
+	int64 const BoundsWidth = static_cast<int64>(Bounds.Max.X) - Bounds.Min.X;
+	int64 const BoundsHeight = static_cast<int64>(Bounds.Max.Y) - Bounds.Min.Y;
+	auto const GetIndexCellsNum = [BoundsWidth, BoundsHeight](uint32 const SizeLog2) -> FInt64Point
+		{
+			int64 const IndexCellSize = int64{ 1 } << SizeLog2;
+			return FInt64Point{ (BoundsWidth + IndexCellSize - 1) >> SizeLog2, (BoundsHeight + IndexCellSize - 1) >> SizeLog2 };
+		};
+	while (GetIndexCellsNum(IndexCellSizeLog2).X * GetIndexCellsNum(IndexCellSizeLog2).Y > MaxIndexCellsNum)
+	{
+		++IndexCellSizeLog2;
+	}
+	IndexCellsNum = FIntPoint{ GetIndexCellsNum(IndexCellSizeLog2) };
+
+	// Rect indices are grouped by index cells with counting sort.
+	IndexCellStarts.Init(0, IndexCellsNum.X * IndexCellsNum.Y + 1);
+	auto const ForEachIndexCellOfRect = [this](FIntRect const & Rect, auto && Visitor)
+		{
+			FIntPoint const FromIndexCellCoords = GetIndexCellCoords(Rect.Min);
+			FIntPoint const ToIndexCellCoords = GetIndexCellCoords(Rect.Max - FIntPoint{ 1, 1 });
+			for (int32 Y = FromIndexCellCoords.Y; Y <= ToIndexCellCoords.Y; ++Y)
+			{
+				for (int32 X = FromIndexCellCoords.X; X <= ToIndexCellCoords.X; ++X)
+				{
+					Visitor(GetIndexCellIndex(FIntPoint{ X, Y }));
+				}
+			}
+		};
+	for (FIntRect const & Rect : Rects)
+	{
+		if (Rect.Width() > 0 && Rect.Height() > 0)
+		{
+			ForEachIndexCellOfRect(Rect, [this](int32 const IndexCellIndex)
+				{
+					++IndexCellStarts[IndexCellIndex + 1];
+				});
+		}
+	}
+	for (int32 IndexCellIndex = 1; IndexCellIndex < IndexCellStarts.Num(); ++IndexCellIndex)
+	{
+		IndexCellStarts[IndexCellIndex] += IndexCellStarts[IndexCellIndex - 1];
+	}
+	RectIndices.SetNumUninitialized(IndexCellStarts.Last());
+	TArray<int32> NextPositions{ IndexCellStarts };
+	for (int32 RectIndex = 0; RectIndex < Rects.Num(); ++RectIndex)
+	{
+		FIntRect const & Rect = Rects[RectIndex];
+		if (Rect.Width() > 0 && Rect.Height() > 0)
+		{
+			ForEachIndexCellOfRect(Rect, [this, RectIndex, &NextPositions](int32 const IndexCellIndex)
+				{
+					RectIndices[NextPositions[IndexCellIndex]++] = RectIndex;
+				});
+		}
+	}
+}
+
+int32 FUEGridRectsIndex::Find(FIntPoint const Coords) const
+{
+	if (!Bounds.Contains(Coords))
+	{
+		return INDEX_NONE;
+	}
+	int32 const IndexCellIndex = GetIndexCellIndex(GetIndexCellCoords(Coords));
+	for (int32 Position = IndexCellStarts[IndexCellIndex]; Position < IndexCellStarts[IndexCellIndex + 1]; ++Position)
+	{
+		if (Rects[RectIndices[Position]].Contains(Coords))
+		{
+			return RectIndices[Position];
+		}
+	}
+	return INDEX_NONE;
+}
+
+void FUEGridRectsIndex::FindIntersecting(FIntRect const & Rect, TArray<int32> & OutIndices) const
+{
+	if (IndexCellStarts.IsEmpty())
+	{
+		return;
+	}
+	// Rect of zero size still intersects rects around its minimum corner, same as in FIntRect::Intersect.
+	FIntPoint const LastCoords = Rect.Min.ComponentMax(Rect.Max - FIntPoint{ 1, 1 });
+	FIntPoint const BoundsLastCoords = Bounds.Max - FIntPoint{ 1, 1 };
+	FIntPoint const FromCoords = Rect.Min.ComponentMax(Bounds.Min).ComponentMin(BoundsLastCoords);
+	FIntPoint const FromIndexCellCoords = GetIndexCellCoords(FromCoords);
+	FIntPoint const ToIndexCellCoords = GetIndexCellCoords(LastCoords.ComponentMax(Bounds.Min).ComponentMin(BoundsLastCoords));
+
+	int32 const FirstOutIndex = OutIndices.Num();
+	for (int32 Y = FromIndexCellCoords.Y; Y <= ToIndexCellCoords.Y; ++Y)
+	{
+		for (int32 X = FromIndexCellCoords.X; X <= ToIndexCellCoords.X; ++X)
+		{
+			FIntPoint const IndexCellCoords{ X, Y };
+			int32 const IndexCellIndex = GetIndexCellIndex(IndexCellCoords);
+			for (int32 Position = IndexCellStarts[IndexCellIndex]; Position < IndexCellStarts[IndexCellIndex + 1]; ++Position)
+			{
+				// Rect spanning several index cells is taken only in the first of them.
+				int32 const RectIndex = RectIndices[Position];
+				if (Rects[RectIndex].Intersect(Rect) && GetIndexCellCoords(Rects[RectIndex].Min.ComponentMax(FromCoords)) == IndexCellCoords)
+				{
+					OutIndices.Emplace(RectIndex);
+				}
+			}
+		}
+	}
+	Algo::Sort(MakeArrayView(OutIndices.GetData() + FirstOutIndex, OutIndices.Num() - FirstOutIndex));
+}
+
+FIntPoint FUEGridRectsIndex::GetIndexCellCoords(FIntPoint const Coords) const
+{
+	int64 const X = (static_cast<int64>(Coords.X) - Bounds.Min.X) >> IndexCellSizeLog2;
+	int64 const Y = (static_cast<int64>(Coords.Y) - Bounds.Min.Y) >> IndexCellSizeLog2;
+	return FIntPoint{ static_cast<int32>(X), static_cast<int32>(Y) };
+}
+
+int32 FUEGridRectsIndex::GetIndexCellIndex(FIntPoint const IndexCellCoords) const
+{
+	return IndexCellCoords.Y * IndexCellsNum.X + IndexCellCoords.X;
+}
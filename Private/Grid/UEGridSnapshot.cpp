@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "Grid/UEGridSnapshot.h"
+#include "Grid/UEGridSystem.h"
+
+uint64 FUEGridSnapshot::GetGeneration() const
+{
+	return Generation;
+}
+
+bool FUEGridSnapshot::IsInGrid(FIntPoint const CellCoords) const
+{
+	return GridRectsIndex.Find(CellCoords) != INDEX_NONE;
+}
+
+bool FUEGridSnapshot::IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint const CellCoords) const
+{
+	int32 const ComponentIndex = GridRectsIndex.Find(CellCoords);
+	return ComponentIndex != INDEX_NONE && GetLayer(ComponentIndex, GridLayer)[FUintPoint{ CellCoords - GridRects[ComponentIndex].Min }];
+}
+
+bool FUEGridSnapshot::HasOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect) const
+{
+	bool const bValue = true;
+	bool const bIsVisitingFinished = VisitGridComponents(Rect, [this, GridLayer, bValue](int32 const ComponentIndex, FUintRect const & LayerRect)
+		{
+			return !GetLayer(ComponentIndex, GridLayer).Contains(LayerRect, bValue);
+		});
+	return !bIsVisitingFinished;
+}
+
+int64 FUEGridSnapshot::CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const
+{
+	bool const bValue = true;
+	int64 Count = 0;
+	VisitGridComponents(Rect, [this, GridLayer, bValue, &Count](int32 const ComponentIndex, FUintRect const & LayerRect)
+		{
+			Count += GetLayer(ComponentIndex, GridLayer).CountCells(LayerRect, bValue);
+			return true;
+		});
+	return Count;
+}
+
+void FUEGridSnapshot::ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const
+{
+	bool const bValue = true;
+	VisitGridComponents(Rect, [this, GridLayer, bValue, &Visitor](int32 const ComponentIndex, FUintRect const & LayerRect)
+		{
+			FIntPoint const GridRectMin = GridRects[ComponentIndex].Min;
+			GetLayer(ComponentIndex, GridLayer).ForEachCell(LayerRect, bValue, [GridRectMin, &Visitor](FUintPoint const CellCoords)
+				{
+					Visitor(FIntPoint{ CellCoords } + GridRectMin);
+				});
+			return true;
+		});
+}
+
+bool FUEGridSnapshot::VisitGridComponents(FIntRect const & Rect, TFunctionRef<bool (int32 const, FUintRect const &)> Visitor) const
+{
+	TArray<int32> ComponentIndices;
+	GridRectsIndex.FindIntersecting(Rect, ComponentIndices);
+	for (int32 const ComponentIndex : ComponentIndices)
+	{
+		FIntRect const & GridRect = GridRects[ComponentIndex];
+		FIntRect ClippedRect = GridRect;
+		ClippedRect.Clip(Rect);
+		if (!Visitor(ComponentIndex, FUintRect{ FUintPoint{ ClippedRect.Min - GridRect.Min }, FUintPoint{ ClippedRect.Max - GridRect.Min } }))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+FUEGridLayer const & FUEGridSnapshot::GetLayer(int32 const ComponentIndex, EUEGridLayer const GridLayer) const
+{
+	check(static_cast<uint8>(GridLayer) < GridLayers[ComponentIndex].Num());
+	return GridLayers[ComponentIndex][static_cast<uint8>(GridLayer)];
+}
@@ -1,14 +1,54 @@
 // Fill out your copyright notice in the Description page of Project Settings.
 
 #include "Grid/UEGridSystem.h"
+#include "Algo/Compare.h"
+#include "Async/Async.h"
 #include "Common/UELog.h"
 #include "Grid/UEGridComponent.h"
+#include "Grid/UEGridSnapshot.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "Tasks/Pipe.h"
 
 UUEGridSystem::UUEGridSystem()
 	: CellSize(100.f)
+	, BroadcastGeneration(0)
+	, GridComponentsVersion(1)
+	, BroadcastGridComponentsVersion(1)
 {
 }
 
+void UUEGridSystem::Initialize(FSubsystemCollectionBase & Collection)
+{
+	Super::Initialize(Collection);
+
+	StreamingTaskPipe.Reset(new UE::Tasks::FPipe(UE_SOURCE_LOCATION));
+}
+
+void UUEGridSystem::Deinitialize()
+{
+	if (StreamingTaskPipe)
+	{
+		StreamingTaskPipe->WaitUntilEmpty();
+	}
+	StreamingTaskPipe.Reset();
+	StreamedOutGridLayers.Empty();
+
+	Super::Deinitialize();
+}
+
+void UUEGridSystem::Tick(float const DeltaTime)
+{
+	Super::Tick(DeltaTime);
+	BroadcastGridChanges();
+}
+
+TStatId UUEGridSystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UUEGridSystem, STATGROUP_Tickables);
+}
+
 void UUEGridSystem::RegisterGridComponent(TObjectPtr<UUEGridComponent> const GridComponent)
 {
 	if (!IsValid(GridComponent))
@@ -17,21 +57,23 @@ void UUEGridSystem::RegisterGridComponent(TObjectPtr<UUEGridComponent> const Gri
 	}
 
 	check(GridComponents.Num() == GridRects.Num());
+	if (GridComponents.Contains(GridComponent))
+	{
+		return;
+	}
 	FIntRect const GridRect = GridComponent->GetGridRect();
-	for (size_t ComponentIndex = 0; ComponentIndex < GridComponents.Num(); ++ComponentIndex)
+	TArray<int32> OverlappingIndices;
+	GridRectsIndex.FindIntersecting(GridRect, OverlappingIndices);
+	if (!OverlappingIndices.IsEmpty())
 	{
-		if (GridComponents[ComponentIndex] == GridComponent)
-		{
-			return;
-		}
-		if (GridRects[ComponentIndex].Intersect(GridRect))
-		{
-			UE_LOGFMT(LogUE, Warning, "UUEGridComponent \"{0}\" overlaps with already placed grid, it cannot be registered.", GridComponent->GetName());
-			return;
-		}
+		UE_LOGFMT(LogUE, Warning, "UUEGridComponent \"{0}\" overlaps with already placed grid, it cannot be registered.", GridComponent->GetName());
+		return;
 	}
 	GridComponents.Emplace(GridComponent);
 	GridRects.Emplace(GridRect);
+	GridRectsIndex.Build(GridRects);
+	++GridComponentsVersion;
+	RegistrationChangedRects.Emplace(GridRect);
 }
 
 void UUEGridSystem::UnregisterGridComponent(TObjectPtr<UUEGridComponent> const GridComponent)
@@ -43,8 +85,11 @@ void UUEGridSystem::UnregisterGridComponent(TObjectPtr<UUEGridComponent> const G
 
 	if (size_t const ComponentIndex = GridComponents.Find(GridComponent); ComponentIndex != INDEX_NONE)
 	{
+		RegistrationChangedRects.Emplace(GridRects[ComponentIndex]);
 		GridComponents.RemoveAtSwap(ComponentIndex);
 		GridRects.RemoveAtSwap(ComponentIndex);
+		GridRectsIndex.Build(GridRects);
+		++GridComponentsVersion;
 	}
 }
 
@@ -55,15 +100,8 @@ TObjectPtr<UUEGridComponent> UUEGridSystem::GetGridComponent(FVector2D const Coo
 
 TObjectPtr<UUEGridComponent> UUEGridSystem::GetGridComponent(FIntPoint const Coords) const
 {
-	check(GridComponents.Num() == GridRects.Num());
-	for (size_t ComponentIndex = 0; ComponentIndex < GridComponents.Num(); ++ComponentIndex)
-	{
-		if (GridRects[ComponentIndex].Contains(Coords))
-		{
-			return GridComponents[ComponentIndex];
-		}
-	}
-	return nullptr;
+	int32 const ComponentIndex = FindGridComponentIndex(Coords);
+	return ComponentIndex != INDEX_NONE ? GridComponents[ComponentIndex] : nullptr;
 }
 
 TArray<TObjectPtr<UUEGridComponent>> UUEGridSystem::GetGridComponents(FBox2D const & Rect) const
@@ -74,13 +112,13 @@ TArray<TObjectPtr<UUEGridComponent>> UUEGridSystem::GetGridComponents(FBox2D con
 TArray<TObjectPtr<UUEGridComponent>> UUEGridSystem::GetGridComponents(FIntRect const Rect) const
 {
 	check(GridComponents.Num() == GridRects.Num());
+	TArray<int32> ComponentIndices;
+	GridRectsIndex.FindIntersecting(Rect, ComponentIndices);
 	TArray<TObjectPtr<UUEGridComponent>> Components;
-	for (size_t ComponentIndex = 0; ComponentIndex < GridComponents.Num(); ++ComponentIndex)
+	Components.Reserve(ComponentIndices.Num());
+	for (int32 const ComponentIndex : ComponentIndices)
 	{
-		if (GridRects[ComponentIndex].Intersect(Rect))
-		{
-			Components.Emplace(GridComponents[ComponentIndex]);
-		}
+		Components.Emplace(GridComponents[ComponentIndex]);
 	}
 	return Components;
 }
@@ -104,14 +142,7 @@ FIntRect UUEGridSystem::GetIntRect(FBox2D const & Rect) const
 
 bool UUEGridSystem::IsInGrid(FIntPoint const CellCoords) const
 {
-	for (FIntRect const & Rect : GridRects)
-	{
-		if (Rect.Contains(CellCoords))
-		{
-			return true;
-		}
-	}
-	return false;
+	return FindGridComponentIndex(CellCoords) != INDEX_NONE;
 }
 
 bool UUEGridSystem::IsCellOccupied(EUEGridLayer const GridLayer, FVector2D const Coords) const
@@ -128,6 +159,46 @@ bool UUEGridSystem::IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint const
 	return false;
 }
 
+void UUEGridSystem::IsCellsOccupied(EUEGridLayer const GridLayer, TConstArrayView<FIntPoint> const CellsCoords, TBitArray<> & OutIsOccupied) const
+{
+	OutIsOccupied.Reset();
+	OutIsOccupied.Reserve(CellsCoords.Num());
+	for (int32 RunStart = 0; RunStart < CellsCoords.Num();)
+	{
+		int32 const ComponentIndex = FindGridComponentIndex(CellsCoords[RunStart]);
+		if (ComponentIndex == INDEX_NONE)
+		{
+			OutIsOccupied.Add(false);
+			++RunStart;
+			continue;
+		}
+		// Neighbouring cells mostly lie in the same grid component, so the run is cut only by the first cell outside of it.
+		int32 RunEnd = RunStart + 1;
+		while (RunEnd < CellsCoords.Num() && GridRects[ComponentIndex].Contains(CellsCoords[RunEnd]))
+		{
+			++RunEnd;
+		}
+		GridComponents[ComponentIndex]->IsCellsOccupied(GridLayer, CellsCoords.Slice(RunStart, RunEnd - RunStart), OutIsOccupied);
+		RunStart = RunEnd;
+	}
+}
+
+void UUEGridSystem::ExtractRectMask(EUEGridLayer const GridLayer, FIntRect const & Rect, TBitArray<> & OutMask) const
+{
+	bool const bIsOccupied = false;
+	if (Rect.Width() <= 0 || Rect.Height() <= 0)
+	{
+		OutMask.Init(bIsOccupied, 0);
+		return;
+	}
+	OutMask.Init(bIsOccupied, Rect.Area());
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(Rect))
+	{
+		check(GridComponent);
+		GridComponent->ExtractRectMask(GridLayer, Rect, OutMask);
+	}
+}
+
 bool UUEGridSystem::SetCellState(EUEGridLayer const GridLayer, FVector2D const Coords, bool const bIsOccupied)
 {
 	return SetCellState(GridLayer, GetCellCoords(Coords), bIsOccupied);
@@ -142,6 +213,15 @@ bool UUEGridSystem::SetCellState(EUEGridLayer const GridLayer, FIntPoint const C
 	return false;
 }
 
+bool UUEGridSystem::IsCellBlockedForPath(EUEGridLayer const PathGridLayer, FIntPoint const CellCoords) const
+{
+	if (TObjectPtr<UUEGridComponent> const GridComponent = GetGridComponent(CellCoords))
+	{
+		return GridComponent->IsCellBlockedForPath(PathGridLayer, CellCoords);
+	}
+	return false;
+}
+
 bool UUEGridSystem::HasOccupiedCell(EUEGridLayer const GridLayer, FBox2D const & Rect) const
 {
 	return HasOccupiedCell(GridLayer, GetIntRect(Rect));
@@ -173,3 +253,429 @@ void UUEGridSystem::SetCellsState(EUEGridLayer const GridLayer, FIntRect const &
 		GridComponent->SetCellsState(GridLayer, Rect, bIsOccupied);
 	}
 }
+
+bool UUEGridSystem::CommitEdit(FUEGridEdit const & Edit)
+{
+	check(IsInGameThread());
+	for (FUEGridEdit::FRequiredFreeRect const & RequiredFreeRect : Edit.RequiredFreeRects)
+	{
+		if (HasOccupiedCell(RequiredFreeRect.GridLayer, RequiredFreeRect.Rect))
+		{
+			return false;
+		}
+	}
+
+	TOptional<FIntRect> EditBounds;
+	for (FUEGridEdit::FStagedOperation const & StagedOperation : Edit.StagedOperations)
+	{
+		if (!StagedOperation.Rect.IsEmpty())
+		{
+			if (EditBounds)
+			{
+				EditBounds->Union(StagedOperation.Rect);
+			}
+			else
+			{
+				EditBounds = StagedOperation.Rect;
+			}
+		}
+	}
+	if (!EditBounds)
+	{
+		return true;
+	}
+	// Grid components don't overlap, so applying all operations component by component keeps their order for every cell.
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(*EditBounds))
+	{
+		check(GridComponent);
+		for (FUEGridEdit::FStagedOperation const & StagedOperation : Edit.StagedOperations)
+		{
+			if (StagedOperation.Rect.IsEmpty() || !GridComponent->GetGridRect().Intersect(StagedOperation.Rect))
+			{
+				continue;
+			}
+			if (StagedOperation.bIsOccupied)
+			{
+				GridComponent->SetCellsState(StagedOperation.DestinationGridLayer, StagedOperation.Rect, *StagedOperation.bIsOccupied);
+			}
+			else
+			{
+				GridComponent->CombineLayers(StagedOperation.DestinationGridLayer, StagedOperation.SourceGridLayerA, StagedOperation.SourceGridLayerB, StagedOperation.Operation, StagedOperation.Rect);
+			}
+		}
+	}
+	return true;
+}
+
+int64 UUEGridSystem::CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const
+{
+	int64 OccupiedCellsNum = 0;
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(Rect))
+	{
+		check(GridComponent);
+		OccupiedCellsNum += GridComponent->CountOccupiedCells(GridLayer, Rect);
+	}
+	return OccupiedCellsNum;
+}
+
+void UUEGridSystem::ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const
+{
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(Rect))
+	{
+		check(GridComponent);
+		GridComponent->ForEachOccupiedCell(GridLayer, Rect, Visitor);
+	}
+}
+
+void UUEGridSystem::FindFreeRects(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, TArray<FIntPoint> & OutAnchors) const
+{
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(Rect))
+	{
+		check(GridComponent);
+		GridComponent->FindFreeRects(GridLayersToCheck, Rect, Size, OutAnchors);
+	}
+}
+
+uint64 UUEGridSystem::GetCurrentGeneration() const
+{
+	return FUEGridLayer::GetCurrentGeneration();
+}
+
+void UUEGridSystem::GetChangedRects(EUEGridLayer const GridLayer, uint64 const SinceGeneration, TArray<FIntRect> & OutRects) const
+{
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GridComponents)
+	{
+		check(GridComponent);
+		GridComponent->GetChangedRects(GridLayer, SinceGeneration, OutRects);
+	}
+}
+
+void UUEGridSystem::BroadcastGridChanges()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridSystem::BroadcastGridChanges);
+	// Generation is taken before gathering changes, so that changes made by subscribers are broadcast next time.
+	uint64 const CurrentGeneration = GetCurrentGeneration();
+	// Cells of unregistered grid components aren't reported by GetChangedRects, so their rects are added to every layer.
+	bool const bHasRegistrationChanges = GridComponentsVersion != BroadcastGridComponentsVersion;
+	bool bHasChanges = false;
+	if (OnGridChanged.IsBound())
+	{
+		for (EUEGridLayer const GridLayer : TEnumRange<EUEGridLayer>())
+		{
+			TArray<FIntRect> & ChangedRects = GridChanges.ChangedRects[static_cast<uint8>(GridLayer)];
+			ChangedRects.Reset();
+			GetChangedRects(GridLayer, BroadcastGeneration, ChangedRects);
+			if (bHasRegistrationChanges)
+			{
+				ChangedRects.Append(RegistrationChangedRects);
+			}
+			bHasChanges |= !ChangedRects.IsEmpty();
+		}
+	}
+	// Updated before broadcasting, so that subscribers calling UpdateFreeRectsMap look up changes.
+	BroadcastGeneration = CurrentGeneration;
+	BroadcastGridComponentsVersion = GridComponentsVersion;
+	RegistrationChangedRects.Reset();
+	if (bHasChanges)
+	{
+		OnGridChanged.Broadcast(GridChanges);
+	}
+}
+
+TSharedRef<FUEGridSnapshot const, ESPMode::ThreadSafe> UUEGridSystem::GetSnapshot()
+{
+	check(IsInGameThread());
+	TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridSystem::GetSnapshot);
+	uint64 const CurrentGeneration = GetCurrentGeneration();
+	if (!Snapshots.IsEmpty() && Snapshots.Last()->Generation == CurrentGeneration && Snapshots.Last()->GridComponentsVersion == GridComponentsVersion)
+	{
+		return Snapshots.Last();
+	}
+
+	// Only snapshots here hold references to themselves, others are held by readers. New references are made only on game thread.
+	int32 const ReusedIndex = Snapshots.IndexOfByPredicate([](TSharedRef<FUEGridSnapshot, ESPMode::ThreadSafe> const & Snapshot)
+		{
+			return Snapshot.IsUnique();
+		});
+	TSharedRef<FUEGridSnapshot, ESPMode::ThreadSafe> Snapshot = ReusedIndex != INDEX_NONE ? Snapshots[ReusedIndex] : MakeShared<FUEGridSnapshot, ESPMode::ThreadSafe>();
+	if (ReusedIndex != INDEX_NONE)
+	{
+		Snapshots.RemoveAt(ReusedIndex);
+	}
+	else if (Snapshots.Num() >= MaxKeptSnapshotsNum)
+	{
+		Snapshots.RemoveAt(0);
+	}
+
+	if (Snapshot->GridComponentsVersion != GridComponentsVersion)
+	{
+		Snapshot->GridRects = GridRects;
+		Snapshot->GridRectsIndex = GridRectsIndex;
+		Snapshot->GridLayers.Reset();
+		Snapshot->GridLayers.SetNum(GridComponents.Num());
+		Snapshot->GridComponentsVersion = GridComponentsVersion;
+	}
+	for (int32 ComponentIndex = 0; ComponentIndex < GridComponents.Num(); ++ComponentIndex)
+	{
+		check(GridComponents[ComponentIndex]);
+		GridComponents[ComponentIndex]->UpdateLayersCopy(Snapshot->GridLayers[ComponentIndex], Snapshot->Generation);
+	}
+	Snapshot->Generation = CurrentGeneration;
+	Snapshots.Emplace(Snapshot);
+	return Snapshot;
+}
+
+void UUEGridSystem::StreamOutGridLayers(FIntRect const & GridRect, TArray<FUEGridLayer> && GridLayers)
+{
+	check(IsInGameThread());
+	if (UNLIKELY(!StreamingTaskPipe))
+	{
+		return;
+	}
+	TSharedRef<FUEStreamedOutGridLayers, ESPMode::ThreadSafe> const StreamedOutLayers = MakeShared<FUEStreamedOutGridLayers, ESPMode::ThreadSafe>();
+	StreamedOutGridLayers.Emplace(GridRect, StreamedOutLayers);
+	StreamingTaskPipe->Launch(UE_SOURCE_LOCATION,
+		[StreamedOutLayers, GridLayers = MoveTemp(GridLayers)]() mutable
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridSystem::StreamOutGridLayers);
+			TArray<uint8> SerializedLayers;
+			FMemoryWriter Writer{ SerializedLayers };
+			int32 LayersNum = GridLayers.Num();
+			Writer << LayersNum;
+			for (FUEGridLayer & GridLayer : GridLayers)
+			{
+				// Layer serializes only its cells, the rest is needed to construct it back.
+				uint8 Storage = static_cast<uint8>(GridLayer.GetStorage());
+				uint8 Access = static_cast<uint8>(GridLayer.GetAccess());
+				uint8 TileOrder = static_cast<uint8>(GridLayer.GetTileOrder());
+				Writer << Storage << Access << TileOrder;
+				GridLayer.Serialize(Writer);
+			}
+			GridLayers.Empty();
+
+			int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Oodle, SerializedLayers.Num());
+			StreamedOutLayers->CompressedLayers.SetNumUninitialized(CompressedSize);
+			if (!FCompression::CompressMemory(NAME_Oodle, StreamedOutLayers->CompressedLayers.GetData(), CompressedSize, SerializedLayers.GetData(), SerializedLayers.Num()))
+			{
+				UE_LOGFMT(LogUE, Warning, "Compression of streamed out grid layers failed, they will be filled again on stream in.");
+				StreamedOutLayers->CompressedLayers.Empty();
+				return;
+			}
+			StreamedOutLayers->CompressedLayers.SetNum(CompressedSize);
+			StreamedOutLayers->UncompressedSize = SerializedLayers.Num();
+		});
+}
+
+bool UUEGridSystem::StreamInGridLayers(FIntRect const & GridRect, TUniqueFunction<bool (TArray<FUEGridLayer> &&)> && OnStreamedIn)
+{
+	check(IsInGameThread());
+	TSharedRef<FUEStreamedOutGridLayers, ESPMode::ThreadSafe> const * const FoundStreamedOutLayers = StreamedOutGridLayers.Find(GridRect);
+	if (!FoundStreamedOutLayers || UNLIKELY(!StreamingTaskPipe))
+	{
+		return false;
+	}
+	StreamingTaskPipe->Launch(UE_SOURCE_LOCATION,
+		[WeakThis = TWeakObjectPtr<UUEGridSystem>{ this }, GridRect, StreamedOutLayers = *FoundStreamedOutLayers, OnStreamedIn = MoveTemp(OnStreamedIn)]() mutable
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridSystem::StreamInGridLayers);
+			// Layers were compressed by earlier task of the pipe.
+			TArray<FUEGridLayer> GridLayers;
+			TArray<uint8> SerializedLayers;
+			SerializedLayers.SetNumUninitialized(StreamedOutLayers->UncompressedSize);
+			bool bIsRestored = !StreamedOutLayers->CompressedLayers.IsEmpty()
+				&& FCompression::UncompressMemory(NAME_Oodle, SerializedLayers.GetData(), SerializedLayers.Num(), StreamedOutLayers->CompressedLayers.GetData(), StreamedOutLayers->CompressedLayers.Num());
+			if (bIsRestored)
+			{
+				FMemoryReader Reader{ SerializedLayers };
+				int32 LayersNum = 0;
+				Reader << LayersNum;
+				for (int32 LayerIndex = 0; LayerIndex < LayersNum && !Reader.IsError(); ++LayerIndex)
+				{
+					uint8 Storage = 0;
+					uint8 Access = 0;
+					uint8 TileOrder = 0;
+					Reader << Storage << Access << TileOrder;
+					FUEGridLayer & GridLayer = GridLayers.Emplace_GetRef(FUintPoint{ 0, 0 }, static_cast<FUEGridLayer::EStorage>(Storage),
+						static_cast<FUEGridLayer::EAccess>(Access), static_cast<FUEGridLayer::ETileOrder>(TileOrder));
+					GridLayer.Serialize(Reader);
+				}
+				bIsRestored = !Reader.IsError();
+			}
+			if (!bIsRestored)
+			{
+				GridLayers.Empty();
+			}
+			AsyncTask(ENamedThreads::GameThread, [WeakThis, GridRect, StreamedOutLayers, OnStreamedIn = MoveTemp(OnStreamedIn), GridLayers = MoveTemp(GridLayers)]() mutable
+				{
+					if (OnStreamedIn(MoveTemp(GridLayers)) && WeakThis.IsValid())
+					{
+						// Layers may be streamed out again meanwhile.
+						TSharedRef<FUEStreamedOutGridLayers, ESPMode::ThreadSafe> const * const CurrentStreamedOutLayers = WeakThis->StreamedOutGridLayers.Find(GridRect);
+						if (CurrentStreamedOutLayers && *CurrentStreamedOutLayers == StreamedOutLayers)
+						{
+							WeakThis->StreamedOutGridLayers.Remove(GridRect);
+						}
+					}
+				});
+		});
+	return true;
+}
+
+void UUEGridSystem::UpdateFreeRectsMap(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntPoint const Size, FIntRect const & Area, int32 const Margin, FUEGridFreeRectsMap & InOutMap) const
+{
+	bool const bIsSameMap = InOutMap.GetOrientationIndex(Size) != INDEX_NONE && Algo::Compare(InOutMap.GridLayers, GridLayersToCheck)
+		&& InOutMap.Area.Contains(Area.Min) && InOutMap.Area.Contains(Area.Max - FIntPoint{ 1, 1 }) && InOutMap.GridComponentsVersion == GridComponentsVersion;
+	if (bIsSameMap && InOutMap.BroadcastGeneration == BroadcastGeneration)
+	{
+		return;
+	}
+	TRACE_CPUPROFILER_EVENT_SCOPE(UUEGridSystem::UpdateFreeRectsMap);
+	// Generation is taken before looking up changes, so that changes made meanwhile are looked up next time.
+	uint64 const CurrentGeneration = GetCurrentGeneration();
+	if (bIsSameMap)
+	{
+		TArray<FIntRect> ChangedRects;
+		for (EUEGridLayer const GridLayer : InOutMap.GridLayers)
+		{
+			GetChangedRects(GridLayer, InOutMap.Generation, ChangedRects);
+		}
+		// Footprint in either orientation at anchors up to its size before changed cells touches them.
+		FIntPoint const MaxSize = InOutMap.Size.ComponentMax(FIntPoint{ InOutMap.Size.Y, InOutMap.Size.X });
+		for (FIntRect const & ChangedRect : ChangedRects)
+		{
+			UpdateFreeAnchors(FIntRect{ ChangedRect.Min - MaxSize + FIntPoint{ 1, 1 }, ChangedRect.Max }, InOutMap);
+		}
+	}
+	else
+	{
+		InOutMap.Size = Size;
+		InOutMap.GridLayers.Reset();
+		InOutMap.GridLayers.Append(GridLayersToCheck.GetData(), GridLayersToCheck.Num());
+		InOutMap.Area = Area;
+		InOutMap.Area.InflateRect(Margin);
+		InOutMap.GridComponentsVersion = GridComponentsVersion;
+		int32 const AnchorsNum = InOutMap.Area.Area();
+		InOutMap.FreeAnchors[0].Init(false, AnchorsNum);
+		InOutMap.FreeAnchors[1].Init(false, Size.X != Size.Y ? AnchorsNum : 0);
+		UpdateFreeAnchors(InOutMap.Area, InOutMap);
+	}
+	InOutMap.Generation = CurrentGeneration;
+	InOutMap.BroadcastGeneration = BroadcastGeneration;
+}
+
+bool UUEGridSystem::FindNearestFreeRect(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, FIntPoint const DesiredAnchor, FIntPoint & OutAnchor) const
+{
+	bool bIsFound = false;
+	int64 BestDistanceSquared = MAX_int64;
+	for (TObjectPtr<UUEGridComponent> const GridComponent : GetGridComponents(Rect))
+	{
+		check(GridComponent);
+		FIntPoint Anchor;
+		if (GridComponent->FindNearestFreeRect(GridLayersToCheck, Rect, Size, DesiredAnchor, Anchor))
+		{
+			FInt64Point const Offset{ Anchor - DesiredAnchor };
+			int64 const DistanceSquared = Offset.X * Offset.X + Offset.Y * Offset.Y;
+			if (DistanceSquared < BestDistanceSquared)
+			{
+				BestDistanceSquared = DistanceSquared;
+				OutAnchor = Anchor;
+				bIsFound = true;
+			}
+		}
+	}
+	return bIsFound;
+}
+
+int32 UUEGridSystem::FindGridComponentIndex(FIntPoint const CellCoords) const
+{
+	check(GridComponents.Num() == GridRects.Num());
+	return GridRectsIndex.Find(CellCoords);
+}
+
+void UUEGridSystem::UpdateFreeAnchors(FIntRect const & AnchorsRect, FUEGridFreeRectsMap & Map) const
+{
+	FIntRect ClippedAnchorsRect = Map.Area;
+	ClippedAnchorsRect.Clip(AnchorsRect);
+	if (ClippedAnchorsRect.IsEmpty())
+	{
+		return;
+	}
+	int32 const AreaWidth = Map.Area.Width();
+	TArray<FIntPoint> Anchors;
+	for (int32 OrientationIndex = 0; OrientationIndex < 2; ++OrientationIndex)
+	{
+		TBitArray<> & FreeAnchors = Map.FreeAnchors[OrientationIndex];
+		if (FreeAnchors.Num() == 0)
+		{
+			continue;
+		}
+		for (int32 Y = ClippedAnchorsRect.Min.Y; Y < ClippedAnchorsRect.Max.Y; ++Y)
+		{
+			FreeAnchors.SetRange((Y - Map.Area.Min.Y) * AreaWidth + ClippedAnchorsRect.Min.X - Map.Area.Min.X, ClippedAnchorsRect.Width(), false);
+		}
+		// Rect with all rectangles at anchors of ClippedAnchorsRect.
+		FIntPoint const Size = OrientationIndex == 0 ? Map.Size : FIntPoint{ Map.Size.Y, Map.Size.X };
+		Anchors.Reset();
+		FindFreeRects(Map.GridLayers, FIntRect{ ClippedAnchorsRect.Min, ClippedAnchorsRect.Max + Size - FIntPoint{ 1, 1 } }, Size, Anchors);
+		for (FIntPoint const Anchor : Anchors)
+		{
+			FIntPoint const AnchorInArea = Anchor - Map.Area.Min;
+			FreeAnchors[AnchorInArea.Y * AreaWidth + AnchorInArea.X] = true;
+		}
+	}
+}
+
+bool FUEGridFreeRectsMap::IsFree(FIntPoint const Anchor, FIntPoint const InSize) const
+{
+	int32 const OrientationIndex = GetOrientationIndex(InSize);
+	if (OrientationIndex == INDEX_NONE || !Area.Contains(Anchor))
+	{
+		return false;
+	}
+	FIntPoint const AnchorInArea = Anchor - Area.Min;
+	return FreeAnchors[OrientationIndex][AnchorInArea.Y * Area.Width() + AnchorInArea.X];
+}
+
+int32 FUEGridFreeRectsMap::GetOrientationIndex(FIntPoint const InSize) const
+{
+	if (InSize == Size)
+	{
+		return 0;
+	}
+	return InSize == FIntPoint{ Size.Y, Size.X } ? 1 : INDEX_NONE;
+}
+
+void FUEGridEdit::SetCellsState(EUEGridLayer const GridLayer, FIntRect const & Rect, bool const bIsOccupied)
+{
+	FStagedOperation & StagedOperation = StagedOperations.AddDefaulted_GetRef();
+	StagedOperation.Rect = Rect;
+	StagedOperation.DestinationGridLayer = GridLayer;
+	StagedOperation.bIsOccupied = bIsOccupied;
+}
+
+void FUEGridEdit::CombineLayers(EUEGridLayer const DestinationGridLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect)
+{
+	StagedOperations.Emplace(FStagedOperation{ Rect, DestinationGridLayer, TOptional<bool>{}, SourceGridLayerA, SourceGridLayerB, Operation });
+}
+
+void FUEGridEdit::RequireNoOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect)
+{
+	RequiredFreeRects.Emplace(FRequiredFreeRect{ GridLayer, Rect });
+}
+
+bool FUEGridEdit::IsEmpty() const
+{
+	return StagedOperations.IsEmpty() && RequiredFreeRects.IsEmpty();
+}
+
+void FUEGridEdit::Reset()
+{
+	StagedOperations.Reset();
+	RequiredFreeRects.Reset();
+}
+
+TConstArrayView<FIntRect> FUEGridChanges::GetChangedRects(EUEGridLayer const GridLayer) const
+{
+	check(static_cast<uint8>(GridLayer) < ChangedRects.Num());
+	return ChangedRects[static_cast<uint8>(GridLayer)];
+}
@@ -41,6 +41,14 @@ void AUEGridVolume::PreRegisterAllComponents()
 	}
 }
 
+#if WITH_EDITOR
+void AUEGridVolume::BakeNatureObstacleLayer()
+{
+	check(Grid);
+	Grid->BakeNatureObstacleLayer();
+}
+#endif
+
 bool AUEGridVolume::NeedsLoadForServer() const
 {
 	return false;
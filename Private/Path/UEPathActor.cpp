@@ -103,15 +103,26 @@ void AUEPathActor::CreatePreview(TArray<FIntPoint> const & Path)
 	CancelPreview();
 	PathPreview = Path;
 
+	// Grid is not changed until the end of preview creation, so paths at preview coords are queried once.
+	TBitArray<> ArePathsAtPreview;
+	PathPlacement->ArePathsAt(PathPreview, ArePathsAtPreview);
+
 	TMap<FIntPoint, FAdjacentCellsOccupation> AdjacentCellsOccupation;
 	AdjacentCellsOccupation.Reserve(PathPreview.Num() * 5);
-	for (FIntPoint const & Coords : PathPreview)
+	for (int32 PreviewIndex = 0; PreviewIndex < PathPreview.Num(); ++PreviewIndex)
 	{
-		if (UNLIKELY(!GridSystem->IsInGrid(Coords)) || PathPlacement->IsPathAt(Coords))
+		FIntPoint const Coords = PathPreview[PreviewIndex];
+		if (UNLIKELY(!GridSystem->IsInGrid(Coords)) || ArePathsAtPreview[PreviewIndex])
 		{
 			continue;
 		}
-		GetAdjacentOccupiedCells(Coords, AdjacentCellsOccupation.FindOrAdd(Coords));
+		FAdjacentCellsOccupation AdjacentPaths;
+		GetAdjacentOccupiedCells(Coords, AdjacentPaths);
+		FAdjacentCellsOccupation & CoordsOccupation = AdjacentCellsOccupation.FindOrAdd(Coords);
+		for (uint8 UintGridDirection = 0; UintGridDirection < FUEGridDirectionUtil::DirectionsNum; ++UintGridDirection)
+		{
+			CoordsOccupation.NESW[UintGridDirection] |= AdjacentPaths.NESW[UintGridDirection];
+		}
 		for (EUEGridDirection const GridDirection : TEnumRange<EUEGridDirection>())
 		{
 			FIntPoint const AdjacentCoords = FUEGridDirectionUtil::GetAdjacentCoordsUnsafe(Coords, GridDirection);
@@ -121,7 +132,7 @@ void AUEPathActor::CreatePreview(TArray<FIntPoint> const & Path)
 			}
 			uint8 const UintOppositeDirection = static_cast<uint8>(FUEGridDirectionUtil::GetOppositeDirectionUnsafe(GridDirection));
 			AdjacentCellsOccupation.FindOrAdd(AdjacentCoords).NESW[UintOppositeDirection] = true;
-			if (PathPlacement->IsPathAt(AdjacentCoords))
+			if (AdjacentPaths.NESW[static_cast<uint8>(GridDirection)])
 			{
 				GetAdjacentOccupiedCells(AdjacentCoords, AdjacentCellsOccupation[AdjacentCoords]);
 			}
@@ -148,17 +159,22 @@ void AUEPathActor::CreatePreview(TArray<FIntPoint> const & Path)
 			}
 		};
 	// AdjacentCellsOccupation Contains and Remove are used to prevent multiple processing of same coords.
-	for (FIntPoint const & Coords : PathPreview)
+	for (int32 PreviewIndex = 0; PreviewIndex < PathPreview.Num(); ++PreviewIndex)
 	{
-		if (UNLIKELY(!GridSystem->IsInGrid(Coords)) || PathPlacement->IsPathAt(Coords) || !AdjacentCellsOccupation.Contains(Coords))
+		FIntPoint const Coords = PathPreview[PreviewIndex];
+		if (UNLIKELY(!GridSystem->IsInGrid(Coords)) || ArePathsAtPreview[PreviewIndex] || !AdjacentCellsOccupation.Contains(Coords))
 		{
 			continue;
 		}
 		GetPreviewTransform(Coords);
 		AdjacentCellsOccupation.Remove(Coords);
-		for (FIntPoint const AdjacentCoords : FUEGridDirectionUtil::GetAdjacentCoords(Coords))
+		TStaticArray<FIntPoint, FUEGridDirectionUtil::DirectionsNum> const AdjacentCoordsArray = FUEGridDirectionUtil::GetAdjacentCoords(Coords);
+		TBitArray<> ArePathsAtAdjacentCoords;
+		PathPlacement->ArePathsAt(AdjacentCoordsArray, ArePathsAtAdjacentCoords);
+		for (uint8 UintGridDirection = 0; UintGridDirection < FUEGridDirectionUtil::DirectionsNum; ++UintGridDirection)
 		{
-			if (PathPlacement->IsPathAt(AdjacentCoords) && AdjacentCellsOccupation.Contains(AdjacentCoords))
+			FIntPoint const AdjacentCoords = AdjacentCoordsArray[UintGridDirection];
+			if (ArePathsAtAdjacentCoords[UintGridDirection] && AdjacentCellsOccupation.Contains(AdjacentCoords))
 			{
 				EPathMesh PathMesh;
 				int32 InstanceIndex;
@@ -260,6 +276,19 @@ void AUEPathActor::RemovePath(FIntRect const & Rect)
 		FIntRect{ Rect.Min - FIntPoint{ 0, 1 }, Rect.Max - FIntPoint{ 0, Rect.Height() } }
 	};
 
+	// Cells adjacent to adjacent rects lie in Rect expanded by 2, so paths mask of it is enough to get their occupations.
+	FIntRect const PathsMaskRect{ Rect.Min - FIntPoint{ 2, 2 }, Rect.Max + FIntPoint{ 2, 2 } };
+	TBitArray<> PathsMask;
+	if (UUEGridSystem const * const GridSystem = UUEGridLibrary::GetGridSystem(this))
+	{
+		GridSystem->ExtractRectMask(PathPlacement->GetPathRelatedGridLayer(), PathsMaskRect, PathsMask);
+	}
+	else
+	{
+		bool const bIsPath = false;
+		PathsMask.Init(bIsPath, PathsMaskRect.Area());
+	}
+
 	for (FIntRect const & AdjacentRect : AdjacentRects)
 	{
 		for (int32 X = AdjacentRect.Min.X; X < AdjacentRect.Max.X; ++X)
@@ -268,7 +297,11 @@ void AUEPathActor::RemovePath(FIntRect const & Rect)
 			{
 				FIntPoint const Coords{ X, Y };
 				FAdjacentCellsOccupation AdjacentCellsOccupation;
-				GetAdjacentOccupiedCells(Coords, AdjacentCellsOccupation);
+				for (uint8 UintGridDirection = 0; UintGridDirection < FUEGridDirectionUtil::DirectionsNum; ++UintGridDirection)
+				{
+					FIntPoint const MaskCoords = Coords + FUEGridDirectionUtil::GetAdjacentCoordsShifts()[UintGridDirection] - PathsMaskRect.Min;
+					AdjacentCellsOccupation.NESW[UintGridDirection] = PathsMask[MaskCoords.Y * PathsMaskRect.Width() + MaskCoords.X];
+				}
 				EPathMesh PathMesh;
 				FTransform Transform{ ENoInit() };
 				GetPathMeshAndTransform(Coords, AdjacentCellsOccupation, PathMesh, Transform);
@@ -312,12 +345,13 @@ void AUEPathActor::ClearPreviewData()
 void AUEPathActor::GetAdjacentOccupiedCells(FIntPoint const Coords, FAdjacentCellsOccupation & OutAdjacentCellsOccupation) const
 {
 	check(IsValid(PathPlacement));
-	for (EUEGridDirection const GridDirection : TEnumRange<EUEGridDirection>())
+	TBitArray<> ArePathsAtAdjacentCoords;
+	PathPlacement->ArePathsAt(FUEGridDirectionUtil::GetAdjacentCoords(Coords), ArePathsAtAdjacentCoords);
+	for (uint8 UintGridDirection = 0; UintGridDirection < FUEGridDirectionUtil::DirectionsNum; ++UintGridDirection)
 	{
-		FIntPoint const AdjacentCoords = FUEGridDirectionUtil::GetAdjacentCoordsUnsafe(Coords, GridDirection);
-		if (PathPlacement->IsPathAt(AdjacentCoords))
+		if (ArePathsAtAdjacentCoords[UintGridDirection])
 		{
-			OutAdjacentCellsOccupation.NESW[static_cast<uint8>(GridDirection)] = true;
+			OutAdjacentCellsOccupation.NESW[UintGridDirection] = true;
 		}
 	}
 }
@@ -53,7 +53,8 @@ void UUEPathPlacementComponent::RegisterPath(FIntPoint const FromCoords, FIntPoi
 		return;
 	}
 	TObjectPtr<UUEPathSystem> const PathSystem = GetPathSystem();
-	if (UNLIKELY(!IsValid(PathSystem)))
+	TObjectPtr<UUEGridSystem> const GridSystem = UUEGridLibrary::GetGridSystem(this);
+	if (UNLIKELY(!IsValid(PathSystem) || !IsValid(GridSystem)))
 	{
 		return;
 	}
@@ -61,14 +62,20 @@ void UUEPathPlacementComponent::RegisterPath(FIntPoint const FromCoords, FIntPoi
 	FIntPoint const Min = FromCoords.ComponentMin(ToCoords);
 	FIntPoint const Max = FromCoords.ComponentMax(ToCoords);
 	FIntRect const PathRect{ Min, Max + FIntPoint{ 1, 1 } };
-	if (!CanBePlacedOnGrid(PathRect))
+	if (!UUEGridLibrary::IsInSingleGridComponent(this, PathRect))
 	{
 		return;
 	}
 
+	FUEGridEdit GridEdit;
+	GridEdit.RequireNoOccupiedCell(GridLayerToRegisterOn, PathRect);
 	bool const bIsOccupied = true;
-	SetOccupationOnGrid(GridLayerToRegisterOn, PathRect, bIsOccupied);
-	SetOccupationOnGrid(PathRelatedGridLayerToRegisterOn, PathRect, bIsOccupied);
+	GridEdit.SetCellsState(GridLayerToRegisterOn, PathRect, bIsOccupied);
+	GridEdit.SetCellsState(PathRelatedGridLayerToRegisterOn, PathRect, bIsOccupied);
+	if (!GridSystem->CommitEdit(GridEdit))
+	{
+		return;
+	}
 
 	TArray<FIntPoint> VerticesToAdd;
 	TArray<FIntPoint> VerticesToRemove;
@@ -103,25 +110,20 @@ void UUEPathPlacementComponent::UnregisterPath(FIntRect const & Rect) const
 	GatherAdjacentVerticesUpdatesBeforePathUnregistration(Rect, VerticesToAdd, VerticesToRemove, ConnectionsToRemove);
 	int32 const AdjacentVerticesToRemoveNum = VerticesToRemove.Num();
 
-	for (int32 X = Rect.Min.X; X < Rect.Max.X; ++X)
-	{
-		for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; ++Y)
+	GridSystem->ForEachOccupiedCell(PathRelatedGridLayerToRegisterOn, Rect, [this, &VerticesToRemove](FIntPoint const CurrentCoords)
 		{
-			FIntPoint const CurrentCoords{ X, Y };
-			if (GridSystem->IsCellOccupied(PathRelatedGridLayerToRegisterOn, CurrentCoords))
+			if (ShouldBeVertex(CurrentCoords))
 			{
-				if (ShouldBeVertex(CurrentCoords))
-				{
-					VerticesToRemove.Emplace(CurrentCoords);
-				}
-				bool const bIsOccupied = false;
-				SetOccupationOnGrid(GridLayerToRegisterOn, CurrentCoords, bIsOccupied);
+				VerticesToRemove.Emplace(CurrentCoords);
 			}
-		}
-	}
+		});
 
+	// Cells of paths are freed on both layers at once, word by word.
+	FUEGridEdit GridEdit;
+	GridEdit.CombineLayers(GridLayerToRegisterOn, GridLayerToRegisterOn, PathRelatedGridLayerToRegisterOn, EUEGridLayerOperation::AndNot, Rect);
 	bool const bIsOccupied = false;
-	SetOccupationOnGrid(PathRelatedGridLayerToRegisterOn, Rect, bIsOccupied);
+	GridEdit.SetCellsState(PathRelatedGridLayerToRegisterOn, Rect, bIsOccupied);
+	GridSystem->CommitEdit(GridEdit);
 
 	for (int32 AdjacentVertexToRemoveIndex = 0; AdjacentVertexToRemoveIndex < AdjacentVerticesToRemoveNum; ++AdjacentVertexToRemoveIndex)
 	{
@@ -152,6 +154,18 @@ bool UUEPathPlacementComponent::IsPathAt(FIntPoint const Coords) const
 	return GridSystem->IsCellOccupied(PathRelatedGridLayerToRegisterOn, Coords);
 }
 
+void UUEPathPlacementComponent::ArePathsAt(TConstArrayView<FIntPoint> const CoordsArray, TBitArray<> & OutArePaths) const
+{
+	TObjectPtr<UUEGridSystem> const GridSystem = UUEGridLibrary::GetGridSystem(this);
+	if (UNLIKELY(!IsValid(GridSystem)))
+	{
+		bool const bIsPath = false;
+		OutArePaths.Init(bIsPath, CoordsArray.Num());
+		return;
+	}
+	GridSystem->IsCellsOccupied(PathRelatedGridLayerToRegisterOn, CoordsArray, OutArePaths);
+}
+
 bool UUEPathPlacementComponent::ShouldBeVertex(FIntPoint const Coords) const
 {
 	if (!IsPathAt(Coords))
@@ -180,11 +194,12 @@ bool UUEPathPlacementComponent::AreAdjacentCellsCorrespondPattern(FIntPoint cons
 	{
 		return false;
 	}
-	for (EUEGridDirection const GridDirection : TEnumRange<EUEGridDirection>())
+	TStaticArray<FIntPoint, FUEGridDirectionUtil::DirectionsNum> const AdjacentCellsCoords = FUEGridDirectionUtil::GetAdjacentCoords(Coords);
+	TBitArray<> AreAdjacentCellsOccupied;
+	GridSystem->IsCellsOccupied(PathRelatedGridLayerToRegisterOn, AdjacentCellsCoords, AreAdjacentCellsOccupied);
+	for (uint8 UintGridDirection = 0; UintGridDirection < FUEGridDirectionUtil::DirectionsNum; ++UintGridDirection)
 	{
-		FIntPoint const AdjacentCellCoords = FUEGridDirectionUtil::GetAdjacentCoordsUnsafe(Coords, GridDirection);
-		uint8 const UintGridDirection = static_cast<uint8>(GridDirection);
-		if (GridSystem->IsCellOccupied(PathRelatedGridLayerToRegisterOn, AdjacentCellCoords) != Pattern[UintGridDirection])
+		if (AreAdjacentCellsOccupied[UintGridDirection] != Pattern[UintGridDirection])
 		{
 			return false;
 		}
@@ -343,15 +358,16 @@ void UUEPathPlacementComponent::GetVertexConnections(FIntPoint const VertexCoord
 
 void UUEPathPlacementComponent::GetVertexCoordsFromRect(FIntRect const & Rect, TArray<FIntPoint> & OutVertexCoords) const
 {
-	for (int32 X = Rect.Min.X; X < Rect.Max.X; ++X)
+	TObjectPtr<UUEGridSystem> const GridSystem = UUEGridLibrary::GetGridSystem(this);
+	if (UNLIKELY(!IsValid(GridSystem)))
 	{
-		for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; ++Y)
+		return;
+	}
+	GridSystem->ForEachOccupiedCell(PathRelatedGridLayerToRegisterOn, Rect, [this, &OutVertexCoords](FIntPoint const CurrentCoords)
 		{
-			FIntPoint const CurrentCoords{ X, Y };
 			if (ShouldBeVertex(CurrentCoords))
 			{
 				OutVertexCoords.Emplace(CurrentCoords);
 			}
-		}
-	}
+		});
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Grid/UEGridLayer.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+	/** Layers are as big as a large map, so that they don't fit in caches. */
+	FUintPoint const BenchmarkLayerSize{ 2048, 2048 };
+	constexpr int32 BenchmarkRectsNum = 1 << 17;
+	constexpr int32 BenchmarkSeed = 1;
+
+	/** Returns random rects with sizes between MinSize and MaxSize lying in benchmarked layers, the same for every layer. */
+	TArray<FUintRect> MakeRandomRects(FUintPoint const MinSize, FUintPoint const MaxSize, int32 const RectsNum, int32 const Seed)
+	{
+		FRandomStream RandomStream{ Seed };
+		TArray<FUintRect> Rects;
+		Rects.Reserve(RectsNum);
+		for (int32 RectIndex = 0; RectIndex < RectsNum; ++RectIndex)
+		{
+			FUintPoint const Size{ static_cast<uint32>(RandomStream.RandRange(MinSize.X, MaxSize.X)), static_cast<uint32>(RandomStream.RandRange(MinSize.Y, MaxSize.Y)) };
+			FUintPoint const Min{ static_cast<uint32>(RandomStream.RandRange(0, BenchmarkLayerSize.X - Size.X)), static_cast<uint32>(RandomStream.RandRange(0, BenchmarkLayerSize.Y - Size.Y)) };
+			Rects.Emplace(Min, Min + Size);
+		}
+		return Rects;
+	}
+
+	/** Returns milliseconds Body took. */
+	template <typename BodyType>
+	double MeasureMilliseconds(BodyType && Body)
+	{
+		double const StartSeconds = FPlatformTime::Seconds();
+		Body();
+		return (FPlatformTime::Seconds() - StartSeconds) * 1000.;
+	}
+
+	/** Sets cells of OccupiedRects, like buildings and roads being placed, then checks CheckedRects for occupied cells, like placement does. */
+	template <typename LayerType>
+	void BenchmarkSetCellsAndContains(FAutomationTestBase & Test, FString const & LayerName, LayerType & Layer, TConstArrayView<FUintRect> const OccupiedRects,
+		TConstArrayView<FUintRect> const CheckedRects, int32 & InOutOccupiedRectsNum)
+	{
+		double const SetCellsMilliseconds = MeasureMilliseconds([&Layer, OccupiedRects]()
+			{
+				for (FUintRect const & Rect : OccupiedRects)
+				{
+					Layer.SetCells(Rect, true);
+				}
+			});
+		int32 OccupiedRectsNum = 0;
+		double const ContainsMilliseconds = MeasureMilliseconds([&Layer, CheckedRects, &OccupiedRectsNum]()
+			{
+				for (FUintRect const & Rect : CheckedRects)
+				{
+					OccupiedRectsNum += Layer.Contains(Rect, true);
+				}
+			});
+		Test.AddInfo(FString::Printf(TEXT("%s: SetCells %.2f ms, Contains %.2f ms."), *LayerName, SetCellsMilliseconds, ContainsMilliseconds));
+		// Every layer must give the same results, so that they are comparable.
+		if (InOutOccupiedRectsNum == INDEX_NONE)
+		{
+			InOutOccupiedRectsNum = OccupiedRectsNum;
+		}
+		Test.TestEqual(FString::Printf(TEXT("%s occupied rects"), *LayerName), OccupiedRectsNum, InOutOccupiedRectsNum);
+	}
+
+	template <typename LayerType>
+	void BenchmarkTileShape(FAutomationTestBase & Test, TConstArrayView<FUintRect> const OccupiedRects, TConstArrayView<FUintRect> const CheckedRects, int32 & InOutOccupiedRectsNum)
+	{
+		LayerType Layer{ BenchmarkLayerSize };
+		FString const LayerName = FString::Printf(TEXT("%u x %u cells tile of %u-bit words"), LayerType::NumWordsPerTile, LayerType::NumCellsPerColumnWord, LayerType::NumCellsPerColumnWord);
+		BenchmarkSetCellsAndContains(Test, LayerName, Layer, OccupiedRects, CheckedRects, InOutOccupiedRectsNum);
+	}
+
+	/** Reads 3 x 3 neighbourhoods of cells along random segments, as A* does expanding nodes towards its goal. */
+	int32 ReadNeighbourhoodsAlongSegments(FUEGridLayer const & Layer, int32 const SegmentsNum, int32 const SegmentLength, int32 const Seed)
+	{
+		FRandomStream RandomStream{ Seed };
+		int32 OccupiedCellsNum = 0;
+		for (int32 SegmentIndex = 0; SegmentIndex < SegmentsNum; ++SegmentIndex)
+		{
+			FIntPoint Coords{ RandomStream.RandRange(SegmentLength + 1, BenchmarkLayerSize.X - SegmentLength - 2), RandomStream.RandRange(SegmentLength + 1, BenchmarkLayerSize.Y - SegmentLength - 2) };
+			FIntPoint const Step{ RandomStream.RandRange(-1, 1), RandomStream.RandRange(-1, 1) };
+			for (int32 StepIndex = 0; StepIndex < SegmentLength; ++StepIndex, Coords += Step)
+			{
+				for (int32 Y = Coords.Y - 1; Y <= Coords.Y + 1; ++Y)
+				{
+					for (int32 X = Coords.X - 1; X <= Coords.X + 1; ++X)
+					{
+						OccupiedCellsNum += Layer.GetCell(FUintPoint{ static_cast<uint32>(X), static_cast<uint32>(Y) });
+					}
+				}
+			}
+		}
+		return OccupiedCellsNum;
+	}
+
+	void BenchmarkTileOrder(FAutomationTestBase & Test, FUEGridLayer::ETileOrder const TileOrder, TCHAR const * const TileOrderName, int32 & InOutOccupiedRectsNum, int32 & InOutOccupiedCellsNum)
+	{
+		FUEGridLayer Layer{ BenchmarkLayerSize, FUEGridLayer::EStorage::Dense, FUEGridLayer::EAccess::Exclusive, TileOrder };
+		// Whole tiles are filled tile by tile in Morton order, but row by row in row-major order.
+		TArray<FUintRect> const AreaRects = MakeRandomRects(FUintPoint{ 64, 64 }, FUintPoint{ 256, 256 }, BenchmarkRectsNum / 64, BenchmarkSeed);
+		double const AreaSetCellsMilliseconds = MeasureMilliseconds([&Layer, &AreaRects]()
+			{
+				for (FUintRect const & Rect : AreaRects)
+				{
+					Layer.SetCells(Rect, true);
+					Layer.SetCells(Rect, false);
+				}
+			});
+		Test.AddInfo(FString::Printf(TEXT("%s: SetCells of areas %.2f ms."), TileOrderName, AreaSetCellsMilliseconds));
+
+		TArray<FUintRect> const OccupiedRects = MakeRandomRects(FUintPoint{ 1, 1 }, FUintPoint{ 8, 8 }, BenchmarkRectsNum / 4, BenchmarkSeed + 1);
+		TArray<FUintRect> const Footprints = MakeRandomRects(FUintPoint{ 2, 2 }, FUintPoint{ 6, 6 }, BenchmarkRectsNum, BenchmarkSeed + 2);
+		BenchmarkSetCellsAndContains(Test, FString::Printf(TEXT("%s footprints"), TileOrderName), Layer, OccupiedRects, Footprints, InOutOccupiedRectsNum);
+
+		int32 OccupiedCellsNum = 0;
+		double const NeighbourhoodsMilliseconds = MeasureMilliseconds([&Layer, &OccupiedCellsNum]()
+			{
+				OccupiedCellsNum = ReadNeighbourhoodsAlongSegments(Layer, BenchmarkRectsNum / 64, 256, BenchmarkSeed + 3);
+			});
+		Test.AddInfo(FString::Printf(TEXT("%s: A* neighbourhoods %.2f ms."), TileOrderName, NeighbourhoodsMilliseconds));
+		if (InOutOccupiedCellsNum == INDEX_NONE)
+		{
+			InOutOccupiedCellsNum = OccupiedCellsNum;
+		}
+		Test.TestEqual(FString::Printf(TEXT("%s occupied cells"), TileOrderName), OccupiedCellsNum, InOutOccupiedCellsNum);
+	}
+
+	/** Fills areas and scatters small rects on Layer, then checks big rects for occupied and for free cells, like area queries of placement and AI do. */
+	void BenchmarkBigRectsContains(FAutomationTestBase & Test, FUEGridLayer::EAccess const Access, TCHAR const * const LayerName, int32 & InOutOccupiedRectsNum, int32 & InOutFreeRectsNum)
+	{
+		FUEGridLayer Layer{ BenchmarkLayerSize, FUEGridLayer::EStorage::Dense, Access };
+		// Areas like lakes and districts make full tiles, scattered buildings leave most of other tiles empty.
+		for (FUintRect const & Rect : MakeRandomRects(FUintPoint{ 64, 64 }, FUintPoint{ 256, 256 }, 32, BenchmarkSeed))
+		{
+			Layer.SetCells(Rect, true);
+		}
+		for (FUintRect const & Rect : MakeRandomRects(FUintPoint{ 1, 1 }, FUintPoint{ 8, 8 }, BenchmarkRectsNum / 1024, BenchmarkSeed + 1))
+		{
+			Layer.SetCells(Rect, true);
+		}
+
+		TArray<FUintRect> const CheckedRects = MakeRandomRects(FUintPoint{ 64, 64 }, FUintPoint{ 512, 512 }, BenchmarkRectsNum / 16, BenchmarkSeed + 2);
+		int32 OccupiedRectsNum = 0;
+		double const OccupiedMilliseconds = MeasureMilliseconds([&Layer, &CheckedRects, &OccupiedRectsNum]()
+			{
+				for (FUintRect const & Rect : CheckedRects)
+				{
+					OccupiedRectsNum += Layer.Contains(Rect, true);
+				}
+			});
+		int32 FreeRectsNum = 0;
+		double const FreeMilliseconds = MeasureMilliseconds([&Layer, &CheckedRects, &FreeRectsNum]()
+			{
+				for (FUintRect const & Rect : CheckedRects)
+				{
+					FreeRectsNum += Layer.Contains(Rect, false);
+				}
+			});
+		Test.AddInfo(FString::Printf(TEXT("%s: Contains of set cells %.2f ms, Contains of cleared cells %.2f ms."), LayerName, OccupiedMilliseconds, FreeMilliseconds));
+		if (InOutOccupiedRectsNum == INDEX_NONE)
+		{
+			InOutOccupiedRectsNum = OccupiedRectsNum;
+			InOutFreeRectsNum = FreeRectsNum;
+		}
+		Test.TestEqual(FString::Printf(TEXT("%s occupied rects"), LayerName), OccupiedRectsNum, InOutOccupiedRectsNum);
+		Test.TestEqual(FString::Printf(TEXT("%s free rects"), LayerName), FreeRectsNum, InOutFreeRectsNum);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUEGridLayerTileShapeBenchmark, "UndeadEmpire.Grid.Layer.Benchmark.TileShape", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+/** Compares SetCells and Contains of footprints between instantiated tile shapes, to pick FUEGridLayer. */
+bool FUEGridLayerTileShapeBenchmark::RunTest(FString const & Parameters)
+{
+	TArray<FUintRect> const OccupiedRects = MakeRandomRects(FUintPoint{ 1, 1 }, FUintPoint{ 8, 8 }, BenchmarkRectsNum / 4, BenchmarkSeed);
+	TArray<FUintRect> const CheckedRects = MakeRandomRects(FUintPoint{ 1, 1 }, FUintPoint{ 8, 8 }, BenchmarkRectsNum, BenchmarkSeed + 1);
+	int32 OccupiedRectsNum = INDEX_NONE;
+	BenchmarkTileShape<TUEGridLayer<uint32, 8>>(*this, OccupiedRects, CheckedRects, OccupiedRectsNum);
+	BenchmarkTileShape<TUEGridLayer<uint32, 16>>(*this, OccupiedRects, CheckedRects, OccupiedRectsNum);
+	BenchmarkTileShape<TUEGridLayer<uint32, 32>>(*this, OccupiedRects, CheckedRects, OccupiedRectsNum);
+	BenchmarkTileShape<TUEGridLayer<uint64, 8>>(*this, OccupiedRects, CheckedRects, OccupiedRectsNum);
+	BenchmarkTileShape<TUEGridLayer<uint64, 16>>(*this, OccupiedRects, CheckedRects, OccupiedRectsNum);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUEGridLayerTileOrderBenchmark, "UndeadEmpire.Grid.Layer.Benchmark.TileOrder", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+/** Compares Morton and row-major tile order of FUEGridLayer on area fills, footprints and A* neighbourhoods. */
+bool FUEGridLayerTileOrderBenchmark::RunTest(FString const & Parameters)
+{
+	int32 OccupiedRectsNum = INDEX_NONE;
+	int32 OccupiedCellsNum = INDEX_NONE;
+	BenchmarkTileOrder(*this, FUEGridLayer::ETileOrder::RowMajor, TEXT("Row-major"), OccupiedRectsNum, OccupiedCellsNum);
+	BenchmarkTileOrder(*this, FUEGridLayer::ETileOrder::Morton, TEXT("Morton"), OccupiedRectsNum, OccupiedCellsNum);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUEGridLayerTileSummariesBenchmark, "UndeadEmpire.Grid.Layer.Benchmark.TileSummaries", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+/**
+ * Compares Contains of big rects with tile summaries, kept by exclusive layers, and without them, as concurrent layers don't keep them
+ * and always read words of tiles.
+ */
+bool FUEGridLayerTileSummariesBenchmark::RunTest(FString const & Parameters)
+{
+	int32 OccupiedRectsNum = INDEX_NONE;
+	int32 FreeRectsNum = INDEX_NONE;
+	BenchmarkBigRectsContains(*this, FUEGridLayer::EAccess::Exclusive, TEXT("With summaries"), OccupiedRectsNum, FreeRectsNum);
+	BenchmarkBigRectsContains(*this, FUEGridLayer::EAccess::Concurrent, TEXT("Without summaries"), OccupiedRectsNum, FreeRectsNum);
+	return true;
+}
+
+#endif
@@ -83,8 +83,5 @@ bool FUEGridToGraphAdapter::IsInRange(FLocation const Location) const
 bool FUEGridToGraphAdapter::IsBlocked(FLocation const Location) const
 {
 	check(GridSystem);
-	bool const bIsNatureObstacle = GridSystem->IsCellOccupied(EUEGridLayer::NatureObstacle, Location);
-	bool const bIsConstruction = GridSystem->IsCellOccupied(EUEGridLayer::Construction, Location);
-	bool const bIsPath = GridSystem->IsCellOccupied(PathGridLayer, Location);
-	return bIsNatureObstacle || (bIsConstruction && !bIsPath);
+	return GridSystem->IsCellBlockedForPath(PathGridLayer, Location);
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Grid/UEGridSystem.h"
 #include "Grid/UEPreviewCursor.h"
 #include "UEBuildingPreviewCursor.generated.h"
 
@@ -35,6 +36,8 @@ public:
 
 protected:
 	virtual void OnPreviewChanged() override;
+	/** Updates bCanBePlaced even if cursor doesn't move, e.g. when other building is placed or road is removed under it. */
+	void OnGridChanged(FUEGridChanges const & GridChanges);
 
 	TArray<FOverlapResult> GetFoliageOverlaps(FVector const & Location, FQuat const & Rotation) const;
 	virtual void SetupPlayerInputComponent(UInputComponent * PlayerInputComponent) override;
@@ -42,10 +45,29 @@ protected:
 	void RotateAndGridSnap(double const DeltaYaw);
 	void RotateClockwise();
 	void RotateCounterclockwise();
+	/** Updates bCanBePlaced for current location, updating FreeRectsMap with grid changes or rebuilding it around cursor if cursor left it. */
+	void UpdateCanBePlaced();
 
 	UPROPERTY(BlueprintReadOnly)
 	FQuat PreviousPreviewRotation;
 
+	/**
+	 * Whether previewed building can be placed at current location.
+	 */
+	UPROPERTY(BlueprintReadOnly)
+	uint8 bCanBePlaced : 1;
+
+	/**
+	 * Anchors around cursor where footprint of previewed building in either orientation is free, updated only where grid changes.
+	 */
+	FUEGridFreeRectsMap FreeRectsMap;
+	/**
+	 * Number of cells around footprint FreeRectsMap is built for, so that it's rebuilt only once cursor moves that far.
+	 */
+	UPROPERTY(EditDefaultsOnly, Category = "Placement")
+	int32 FreeRectsMapMargin;
+	FDelegateHandle OnGridChangedHandle;
+
 	/**
 	 * Class of building to preview.
 	 */
@@ -13,8 +13,9 @@ class TUEConcurrentSpatialGridIndex;
 
 /**
  * UUEBuildingSystem
+ * Sizes of spatial index are read from [/Script/UndeadEmpire.UEBuildingSystem] section of DefaultGame.ini.
  */
-UCLASS()
+UCLASS(Config = Game)
 class UNDEADEMPIRE_API UUEBuildingSystem : public UWorldSubsystem
 {
 	GENERATED_BODY()
@@ -28,35 +29,58 @@ public:
 	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
 	virtual void Deinitialize() override;
 
-	FIntPoint GetIndexOriginCoords() const;
-	FIntPoint GetIndexSize() const;
+	/**
+	 * Buildings added during one game thread frame, e.g. when a level is loaded, are inserted together by one task taking locks once.
+	 * Must be called on game thread. Building is queued until the end of the frame or the next call of other *Async function,
+	 * so other *Async functions see it, but AddBuilding and GetOverlappedBuildings called directly in the same frame don't.
+	 */
 	void AddBuildingAsync(TObjectPtr<AActor> const BuildingPtr, FIntRect const & BuildingRect);
+	/** Must be called on game thread, as it launches queued buildings first. */
 	void RemoveOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap);
 
-	/*
-	 * Takes overlapped buildings and removes only corresponding to BuildingPtr.
+	/**
+	 * Takes overlapped buildings and removes only corresponding to BuildingPtr. Must be called on game thread.
 	 */
 	void RemoveOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap, TObjectPtr<AActor> const BuildingPtr);
 
+	/** Must be called on game thread, as it launches queued buildings first. */
 	template <std::invocable<TArray<TObjectPtr<AActor>> &&> CallbackType>
-	FORCEINLINE void GetOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap, CallbackType && Callback) const;
+	FORCEINLINE void GetOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap, CallbackType && Callback);
 
 protected:
 	bool AddBuilding(TObjectPtr<AActor> const BuildingPtr, FIntRect const & BuildingRect);
+	/** Returns one bit per building, whether it was added. */
+	TBitArray<> AddBuildings(TConstArrayView<TPair<FIntRect, TObjectPtr<AActor>>> const Buildings);
 	void RemoveOverlappedBuildings(FIntRect const & RectToCheckForOverlap);
 	void RemoveOverlappedBuildings(FIntRect const & RectToCheckForOverlap, TObjectPtr<AActor> const BuildingPtr);
 	TArray<TObjectPtr<AActor>> GetOverlappedBuildings(FIntRect const & RectToCheckForOverlap) const;
 
 private:
+	/** Launches task adding BuildingsToAdd, before any other task is launched so that the order of calls is kept. */
+	void LaunchAddingBuildings();
+
+	/** Size of spatial index chunks in grid cells, multiple of LockCellSize. */
+	UPROPERTY(Config)
+	FIntPoint ChunkSize;
+	/** Size of cells listing overlapping buildings in grid cells. Smaller cells make queries more precise, but buildings are listed in more cells. */
+	UPROPERTY(Config)
+	FIntPoint IndexCellSize;
+	/** Size of area guarded by one lock in grid cells, multiple of IndexCellSize. */
+	UPROPERTY(Config)
+	FIntPoint LockCellSize;
+
 	TUniquePtr<UE::Tasks::FPipe> TaskPipe;
 	TUniquePtr<TUEConcurrentSpatialGridIndex<TObjectPtr<AActor>>> SpatialGridIndex;
+	/** Buildings waiting for AddBuildings. Used on game thread only. */
+	TArray<TPair<FIntRect, TObjectPtr<AActor>>> BuildingsToAdd;
 };
 
 template <std::invocable<TArray<TObjectPtr<AActor>> &&> CallbackType>
-void UUEBuildingSystem::GetOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap, CallbackType && Callback) const
+void UUEBuildingSystem::GetOverlappedBuildingsAsync(FIntRect const & RectToCheckForOverlap, CallbackType && Callback)
 {
 	if (TaskPipe)
 	{
+		LaunchAddingBuildings();
 		TaskPipe->Launch(UE_SOURCE_LOCATION,
 			[this, RectToCheckForOverlap, Callback = Forward<CallbackType>(Callback)]()
 			{
@@ -3,9 +3,15 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Algo/BinarySearch.h"
+#include "Algo/Unique.h"
+#include <atomic>
 
 /**
  * TUEConcurrentSpatialGridIndex
+ *
+ * Coordinates are unbounded: space is split in chunks of ChunkSize, each with its own index cells and locks, which are added when
+ * the first entry overlapping them is inserted. So memory grows only with area covered by entries.
  */
 template <typename DataType>
 class TUEConcurrentSpatialGridIndex
@@ -13,25 +19,50 @@ class TUEConcurrentSpatialGridIndex
 public:
 	using FIndexEntry = TPair<FIntRect, DataType>;
 
-	explicit TUEConcurrentSpatialGridIndex(FIntPoint const InSize, FIntPoint const InIndexCellSize, FIntPoint const InLockCellSize);
+	explicit TUEConcurrentSpatialGridIndex(FIntPoint const InChunkSize, FIntPoint const InIndexCellSize, FIntPoint const InLockCellSize);
 
-	FIntPoint GetSize() const;
+	FIntPoint GetChunkSize() const;
 	FIntPoint GetIndexCellSize() const;
 	FIntPoint GetLockCellSize() const;
+	/** Returns number of index cells in a chunk. */
 	FIntPoint GetIndexCellsNum() const;
+	/** Returns number of lock cells in a chunk. */
 	FIntPoint GetLockCellsNum() const;
+	uint32 GetChunksNum() const;
 
 	bool TryInsert(FIntRect const & Rect, DataType const & Data);
 	bool TryInsert(FIntRect const & Rect, DataType && Data);
 	void InsertUnchecked(FIntRect const & Rect, DataType const & Data);
 	void InsertUnchecked(FIntRect const & Rect, DataType && Data);
+	/**
+	 * Tries to insert every entry as TryInsert does, in given order, so that entry overlapping earlier one of the batch isn't
+	 * inserted. Locks of all entries are taken once. Appends result of every entry to OutResults.
+	 */
+	void TryInsertBatch(TConstArrayView<FIndexEntry> const Entries, TBitArray<> & OutResults);
+	/** Reads without locks first if DataType is POD, see TryForEachOverlappingOptimistic. */
 	bool CheckIfFree(FIntRect const & Rect) const;
 	void Erase(FIntRect const & Rect);
 
+	/** Erases entries overlapping Rect and satisfying Predicate from all their index cells, even from ones outside Rect. */
 	template <typename PredicateType>
 	void EraseByPredicate(FIntRect const & Rect, PredicateType Predicate);
+	/** Erases entries overlapping any of Rects as Erase does, taking locks once. Appends to OutResults whether every rect overlapped some entry. */
+	void EraseBatch(TConstArrayView<FIntRect> const Rects, TBitArray<> & OutResults);
 
+	/** Reads without locks first if DataType is POD, see TryForEachOverlappingOptimistic. */
 	TMap<FIntRect, DataType> GetOverlapping(FIntRect const & Rect) const;
+	/**
+	 * Appends data of entries overlapping Rect, e.g. to array with inline allocator, so that nothing is allocated. Reads without
+	 * locks first if DataType is POD, see TryForEachOverlappingOptimistic.
+	 */
+	template <typename AllocatorType>
+	void GetOverlapping(FIntRect const & Rect, TArray<DataType, AllocatorType> & OutData) const;
+	/**
+	 * Calls Visitor for each entry overlapping Rect once, without hashing: entry is visited only in the first of its index cells
+	 * lying in Rect. Visitor is called under read locks, so it must not change index.
+	 */
+	template <typename VisitorType>
+	void ForEachOverlapping(FIntRect const & Rect, VisitorType && Visitor) const;
 
 private:
 	enum class ERWLockType : uint8
@@ -40,38 +71,197 @@ private:
 		Write
 	};
 
-	class FRWRectScopeLock
+	/**
+	 * Slab allocator of entries, so that entry is stored once however many index cells its rect covers and index cells keep only
+	 * its handle. Slabs never move, so entries may be read under locks of their index cells while other entries are allocated.
+	 */
+	class FEntryPool
 	{
 	public:
-		UE_NODISCARD_CTOR explicit FRWRectScopeLock(TUEConcurrentSpatialGridIndex<DataType> const & InSpatialGridIndex, FIntRect const & InRect, ERWLockType const InLockType);
-		~FRWRectScopeLock();
-		UE_NONCOPYABLE(FRWRectScopeLock)
+		FEntryPool() = default;
+		UE_NONCOPYABLE(FEntryPool)
+
+		template <typename ArgType>
+		uint32 Allocate(FIntRect const & Rect, ArgType && Data);
+		void Free(uint32 const Handle);
+
+		FIndexEntry & operator[](uint32 const Handle);
+		FIndexEntry const & operator[](uint32 const Handle) const;
+		/** Returns entry without locks, or nullptr if handle isn't allocated. Entry may be changing, see TryForEachOverlappingOptimistic. */
+		FIndexEntry const * FindOptimistic(uint32 const Handle) const;
+
+	private:
+		static constexpr uint32 SlabSizeLog2 = 10;
+		static constexpr uint32 SlabSize = 1u << SlabSizeLog2;
+		static constexpr uint32 MaxSlabsNum = 1u << 12;
+
+		TOptional<FIndexEntry> & GetSlot(uint32 const Handle);
+
+		TStaticArray<TUniquePtr<TOptional<FIndexEntry>[]>, MaxSlabsNum> Slabs;
+		/** Number of slots ever taken from slabs, slots freed since then are reused through FreeHandles first. Slabs of taken slots are never changed. */
+		uint32 UsedSlotsNum = 0;
+		TArray<uint32> FreeHandles;
+		FCriticalSection CriticalSection;
+	};
+
+	/**
+	 * Handles of entries in EntryPool, whose rects intersect index cell, kept in blocks of cache line size. Blocks are freed only
+	 * with the cell, so that optimistic readers walking them while cell is changed read wrong handles at worst.
+	 */
+	class FCellInfo
+	{
+	public:
+		FCellInfo() = default;
+		~FCellInfo();
+		UE_NONCOPYABLE(FCellInfo)
+
+		void Add(uint32 const Handle);
+		void Remove(uint32 const Handle);
+		template <typename VisitorType>
+		void ForEachHandle(VisitorType && Visitor) const;
 
 	private:
+		struct FHandlesBlock
+		{
+			static constexpr uint32 Capacity = 14;
+
+			uint32 Handles[Capacity] = {};
+			FHandlesBlock * Next = nullptr;
+		};
+
+		FHandlesBlock * FirstBlock = nullptr;
+		uint32 HandlesNum = 0;
+	};
+
+	/** Square of ChunkSize at Coords * ChunkSize. Chunks are never removed, so they may be referred to by pointers without locks. */
+	struct FChunk
+	{
+		explicit FChunk(FIntPoint const InCoords, uint32 const InId, FIntPoint const IndexCellsNum, FIntPoint const LockCellsNum);
+
+		FIntPoint const Coords;
+		/** Number of chunks added before this one, which orders locks of different chunks. */
+		uint32 const Id;
+		TArray<FCellInfo> Cells;
+		TArray<FRWLock> Locks;
+		/** Sequence of every lock cell, which is odd while lock cell is written and is incremented twice by every write. */
+		TArray<uint32> LockSequences;
+	};
+
+	/**
+	 * Open addressing hash table of chunks by coordinates, which is read without locks. When it gets half full it's replaced by
+	 * bigger one, replaced tables are kept for readers which may still probe them.
+	 */
+	class FChunkMap
+	{
+	public:
+		FChunkMap() = default;
+		UE_NONCOPYABLE(FChunkMap)
+
+		FChunk * Find(FIntPoint const ChunkCoords) const;
+		/** Returns chunk only when it's counted by GetChunksNum, so that scope locks taken afterwards lock it. */
+		FChunk * FindOrAdd(FIntPoint const ChunkCoords, FIntPoint const IndexCellsNum, FIntPoint const LockCellsNum);
+		/** Returns number of added chunks. Chunks with lower ids are always found, later ones may be found or not. */
+		uint32 GetChunksNum() const;
+
+	private:
+		static constexpr int32 MinTableSize = 64;
+
+		static void AddToTable(TArray<FChunk *> & Table, FChunk * const Chunk);
+
+		TArray<TUniquePtr<FChunk>> Chunks;
+		/** Every table ever used, CurrentTable being the last one. */
+		TArray<TUniquePtr<TArray<FChunk *>>> Tables;
+		TArray<FChunk *> * CurrentTable = nullptr;
+		uint32 ChunksNum = 0;
+		FCriticalSection CriticalSection;
+	};
+
+	/** Lock cell of chunk. All locks are taken in order of Key, so any set of them may be locked without deadlocks. */
+	struct FLockCell
+	{
+		uint64 Key = 0;
+		FChunk * Chunk = nullptr;
+		int32 Index = 0;
+	};
+
+	using FLockCells = TArray<FLockCell, TInlineAllocator<16>>;
+
+	/**
+	 * Locks of lock cells of Rects in chunks there were when locks were taken. Locks are taken again if a chunk overlapping Rects
+	 * was added meanwhile. Chunks added later aren't locked, so only chunks with ids below GetChunksNum may be visited under the lock.
+	 */
+	class FRWRectsScopeLock
+	{
+	public:
+		UE_NODISCARD_CTOR explicit FRWRectsScopeLock(TUEConcurrentSpatialGridIndex<DataType> const & InSpatialGridIndex, TConstArrayView<FIntRect> const Rects, ERWLockType const InLockType);
+		~FRWRectsScopeLock();
+		UE_NONCOPYABLE(FRWRectsScopeLock)
+
+		uint32 GetChunksNum() const;
+		/** Checks if lock cells of Rect in all chunks it overlaps are locked. */
+		bool IsLocked(FIntRect const & Rect) const;
+
+	private:
+		void GetLocks() const;
+		void FreeLocks() const;
+
 		TUEConcurrentSpatialGridIndex const & SpatialGridIndex;
-		FIntRect const & Rect;
+		FLockCells LockCells;
+		uint32 ChunksNum = 0;
 		ERWLockType const LockType;
 	};
 
-	friend FRWRectScopeLock;
+	friend FRWRectsScopeLock;
 
-	using FCellInfo = TArray<FIndexEntry>;
-
-	void CheckRange(FIntPoint const Coords) const;
-	void CheckRange(FIntRect const & Rect) const;
+	static FIntPoint DivideAndRoundDown(FIntPoint const Coords, FIntPoint const Divisor);
 	template <typename ArgType>
 	bool TryInsertImpl(FIntRect const & Rect, ArgType && Data);
 	template <typename ArgType>
 	void InsertUncheckedImpl(FIntRect const & Rect, ArgType && Data);
-	void GetLocks(FIntRect const & Rect, ERWLockType const LockType) const;
-	void FreeLocks(FIntRect const & Rect, ERWLockType const LockType) const;
+	template <typename PredicateType>
+	void EraseByPredicateImpl(TConstArrayView<FIntRect> const Rects, PredicateType Predicate, TBitArray<> & OutResults);
+	/** Adds missing chunks overlapped by Rect. */
+	void AddChunks(FIntRect const & Rect);
+	/** Calls Visitor with coordinates of every chunk overlapping Rect, whether it's added or not. */
+	template <typename VisitorType>
+	void ForEachChunkCoords(FIntRect const & Rect, VisitorType && Visitor) const;
+	/** Checks if some chunk overlapping Rect has id not below VisibleChunksNum, so it was added after VisibleChunksNum was taken. */
+	bool HasChunksAddedAfter(FIntRect const & Rect, uint32 const VisibleChunksNum) const;
+	/**
+	 * Calls Visitor with every chunk overlapping Rect with id below VisibleChunksNum and coordinates of the first and the last
+	 * cells of Rect in the chunk. Rect of zero size is considered to cover its minimum corner, same as in FIntRect::Intersect.
+	 */
+	template <typename VisitorType>
+	void ForEachChunk(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const;
+	/** Calls Visitor with every index cell overlapping Rect in chunks with ids below VisibleChunksNum and global coordinates of the index cell. */
+	template <typename VisitorType>
+	void ForEachIndexCell(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const;
+	/** Checks if entry overlaps Rect and IndexCellCoords is coordinates of the index cell it's visited in, see ForEachOverlapping. */
+	bool IsVisitedInIndexCell(FIntRect const & EntryRect, FIntRect const & Rect, FIntPoint const IndexCellCoords) const;
+	void AppendLockCells(FIntRect const & Rect, uint32 const VisibleChunksNum, FLockCells & OutLockCells) const;
+	static void SortLockCells(FLockCells & LockCells);
+	void GetLock(FLockCell const & LockCell, ERWLockType const LockType) const;
+	void FreeLock(FLockCell const & LockCell, ERWLockType const LockType) const;
 	template <typename ArgType>
-	void InsertUncheckedNoLock(FIntRect const & Rect, ArgType && Data);
-	bool CheckIfFreeNoLock(FIntRect const & Rect) const;
+	void InsertUncheckedNoLock(FIntRect const & Rect, ArgType && Data, uint32 const VisibleChunksNum);
+	bool CheckIfFreeNoLock(FIntRect const & Rect, uint32 const VisibleChunksNum) const;
+	template <typename VisitorType>
+	void ForEachOverlappingNoLock(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const;
+	/**
+	 * Calls Visitor for each entry overlapping Rect without taking locks, checking sequences of lock cells before and after.
+	 * Returns false if some lock cell was written or chunk was added meanwhile, then Visitor might be called for torn or already
+	 * erased entries and its results must be dropped. Entries are read while they may be written, so it's used only if DataType is POD.
+	 */
+	template <typename VisitorType>
+	bool TryForEachOverlappingOptimistic(FIntRect const & Rect, VisitorType && Visitor) const;
+	void EraseNoLock(uint32 const Handle, uint32 const VisibleChunksNum);
 
-	TArray<FCellInfo> SpatialGridData;
-	mutable TArray<FRWLock> Locks;
-	FIntPoint const Size;
+	/** Optimistic reads are retried this many times before falling back to read locks. */
+	static constexpr int32 OptimisticReadAttemptsNum = 4;
+
+	FEntryPool EntryPool;
+	FChunkMap ChunkMap;
+	FIntPoint const ChunkSize;
 	FIntPoint const IndexCellSize;
 	FIntPoint const IndexCellsNum;
 	FIntPoint const LockCellSize;
@@ -79,30 +269,27 @@ private:
 };
 
 template <typename DataType>
-TUEConcurrentSpatialGridIndex<DataType>::TUEConcurrentSpatialGridIndex(FIntPoint const InSize, FIntPoint const InIndexCellSize, FIntPoint const InLockCellSize)
-	: Size(InSize)
+TUEConcurrentSpatialGridIndex<DataType>::TUEConcurrentSpatialGridIndex(FIntPoint const InChunkSize, FIntPoint const InIndexCellSize, FIntPoint const InLockCellSize)
+	: ChunkSize(InChunkSize)
 	, IndexCellSize(InIndexCellSize)
-	, IndexCellsNum(InIndexCellSize.GetMin() > 0 ? InSize / InIndexCellSize : FIntPoint::ZeroValue)
+	, IndexCellsNum(InIndexCellSize.GetMin() > 0 ? InChunkSize / InIndexCellSize : FIntPoint::ZeroValue)
 	, LockCellSize(InLockCellSize)
-	, LockCellsNum(InLockCellSize.GetMin() > 0 ? InSize / InLockCellSize : FIntPoint::ZeroValue)
+	, LockCellsNum(InLockCellSize.GetMin() > 0 ? InChunkSize / InLockCellSize : FIntPoint::ZeroValue)
 {
-	check(InSize.X >= 0 && InSize.Y >= 0);
+	check(InChunkSize.X > 0 && InChunkSize.Y > 0);
 
 	check(InIndexCellSize.X > 0 && InIndexCellSize.Y > 0);
-	check(InSize.X % InIndexCellSize.X == 0 && InSize.Y % InIndexCellSize.Y == 0);
+	check(InChunkSize.X % InIndexCellSize.X == 0 && InChunkSize.Y % InIndexCellSize.Y == 0);
 
 	check(0 < InLockCellSize.X && 0 < InLockCellSize.Y);
-	check(InSize.X % InLockCellSize.X == 0 && InSize.Y % InLockCellSize.Y == 0);
+	check(InChunkSize.X % InLockCellSize.X == 0 && InChunkSize.Y % InLockCellSize.Y == 0);
 	check(InLockCellSize.X % InIndexCellSize.X == 0 && InLockCellSize.Y % InIndexCellSize.Y == 0);
-
-	SpatialGridData.SetNum(IndexCellsNum.X * IndexCellsNum.Y);
-	Locks.SetNum(LockCellsNum.X * LockCellsNum.Y);
 }
 
 template <typename DataType>
-FIntPoint TUEConcurrentSpatialGridIndex<DataType>::GetSize() const
+FIntPoint TUEConcurrentSpatialGridIndex<DataType>::GetChunkSize() const
 {
-	return Size;
+	return ChunkSize;
 }
 
 template <typename DataType>
@@ -129,6 +316,12 @@ FIntPoint TUEConcurrentSpatialGridIndex<DataType>::GetLockCellsNum() const
 	return LockCellsNum;
 }
 
+template <typename DataType>
+uint32 TUEConcurrentSpatialGridIndex<DataType>::GetChunksNum() const
+{
+	return ChunkMap.GetChunksNum();
+}
+
 template <typename DataType>
 bool TUEConcurrentSpatialGridIndex<DataType>::TryInsert(FIntRect const & Rect, DataType const & Data)
 {
@@ -145,12 +338,13 @@ template <typename DataType>
 template <typename ArgType>
 bool TUEConcurrentSpatialGridIndex<DataType>::TryInsertImpl(FIntRect const & Rect, ArgType && Data)
 {
-	FRWRectScopeLock WRectScopeLock(*this, Rect, ERWLockType::Write);
-	if (!CheckIfFreeNoLock(Rect))
+	AddChunks(Rect);
+	FRWRectsScopeLock WRectsScopeLock(*this, MakeArrayView(&Rect, 1), ERWLockType::Write);
+	if (!CheckIfFreeNoLock(Rect, WRectsScopeLock.GetChunksNum()))
 	{
 		return false;
 	}
-	InsertUncheckedNoLock(Rect, Forward<ArgType>(Data));
+	InsertUncheckedNoLock(Rect, Forward<ArgType>(Data), WRectsScopeLock.GetChunksNum());
 	return true;
 }
 
@@ -170,15 +364,49 @@ template <typename DataType>
 template <typename ArgType>
 void TUEConcurrentSpatialGridIndex<DataType>::InsertUncheckedImpl(FIntRect const & Rect, ArgType && Data)
 {
-	FRWRectScopeLock WRectScopeLock(*this, Rect, ERWLockType::Write);
-	InsertUncheckedNoLock(Rect, Forward<ArgType>(Data));
+	AddChunks(Rect);
+	FRWRectsScopeLock WRectsScopeLock(*this, MakeArrayView(&Rect, 1), ERWLockType::Write);
+	InsertUncheckedNoLock(Rect, Forward<ArgType>(Data), WRectsScopeLock.GetChunksNum());
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::TryInsertBatch(TConstArrayView<FIndexEntry> const Entries, TBitArray<> & OutResults)
+{
+	TArray<FIntRect, TInlineAllocator<16>> Rects;
+	for (FIndexEntry const & IndexEntry : Entries)
+	{
+		AddChunks(IndexEntry.Key);
+		Rects.Emplace(IndexEntry.Key);
+	}
+
+	FRWRectsScopeLock WRectsScopeLock(*this, Rects, ERWLockType::Write);
+	for (FIndexEntry const & IndexEntry : Entries)
+	{
+		bool const bIsInserted = CheckIfFreeNoLock(IndexEntry.Key, WRectsScopeLock.GetChunksNum());
+		if (bIsInserted)
+		{
+			InsertUncheckedNoLock(IndexEntry.Key, IndexEntry.Value, WRectsScopeLock.GetChunksNum());
+		}
+		OutResults.Add(bIsInserted);
+	}
 }
 
 template <typename DataType>
 bool TUEConcurrentSpatialGridIndex<DataType>::CheckIfFree(FIntRect const & Rect) const
 {
-	FRWRectScopeLock RRectScopeLock(*this, Rect, ERWLockType::ReadOnly);
-	return CheckIfFreeNoLock(Rect);
+	if constexpr (TIsPODType<DataType>::Value)
+	{
+		for (int32 Attempt = 0; Attempt < OptimisticReadAttemptsNum; ++Attempt)
+		{
+			bool IsFree = true;
+			if (TryForEachOverlappingOptimistic(Rect, [&IsFree](FIndexEntry const & IndexEntry) { IsFree = false; }))
+			{
+				return IsFree;
+			}
+		}
+	}
+	FRWRectsScopeLock RRectsScopeLock(*this, MakeArrayView(&Rect, 1), ERWLockType::ReadOnly);
+	return CheckIfFreeNoLock(Rect, RRectsScopeLock.GetChunksNum());
 }
 
 template <typename DataType>
@@ -191,16 +419,59 @@ template <typename DataType>
 template <typename PredicateType>
 void TUEConcurrentSpatialGridIndex<DataType>::EraseByPredicate(FIntRect const & Rect, PredicateType Predicate)
 {
-	CheckRange(Rect);
-	FRWRectScopeLock WRectScopeLock(*this, Rect, ERWLockType::Write);
-	FIntRect const IndexCellsRect = FIntRect::DivideAndRoundUp(Rect, IndexCellSize);
-	for (int64 Y = IndexCellsRect.Min.Y; Y < IndexCellsRect.Max.Y; ++Y)
+	TBitArray<> Results;
+	EraseByPredicateImpl(MakeArrayView(&Rect, 1), MoveTemp(Predicate), Results);
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::EraseBatch(TConstArrayView<FIntRect> const Rects, TBitArray<> & OutResults)
+{
+	EraseByPredicateImpl(Rects, [](FIndexEntry const & IndexEntry) -> bool { return true; }, OutResults);
+}
+
+template <typename DataType>
+template <typename PredicateType>
+void TUEConcurrentSpatialGridIndex<DataType>::EraseByPredicateImpl(TConstArrayView<FIntRect> const Rects, PredicateType Predicate, TBitArray<> & OutResults)
+{
+	// Erased entries may stick out of Rects, so their rects are locked too and entries are looked up again under new locks.
+	TArray<FIntRect, TInlineAllocator<16>> RectsToLock;
+	RectsToLock.Append(Rects.GetData(), Rects.Num());
+	TArray<uint32, TInlineAllocator<16>> HandlesToErase;
+	int32 const FirstResultIndex = OutResults.Num();
+	while (true)
 	{
-		int64 const IndexOffset = Y * IndexCellsNum.X;
-		for (int64 X = IndexCellsRect.Min.X; X < IndexCellsRect.Max.X; ++X)
+		FRWRectsScopeLock WRectsScopeLock(*this, RectsToLock, ERWLockType::Write);
+		HandlesToErase.Reset();
+		OutResults.SetNumUninitialized(FirstResultIndex);
+		bool bAreEntriesLocked = true;
+		for (FIntRect const & Rect : Rects)
+		{
+			int32 const FirstHandleIndex = HandlesToErase.Num();
+			ForEachOverlappingNoLock(Rect, WRectsScopeLock.GetChunksNum(), [this, &Predicate, &HandlesToErase, &RectsToLock, &WRectsScopeLock, &bAreEntriesLocked](uint32 const Handle)
+				{
+					FIndexEntry const & IndexEntry = EntryPool[Handle];
+					if (Predicate(IndexEntry))
+					{
+						HandlesToErase.Emplace(Handle);
+						if (!WRectsScopeLock.IsLocked(IndexEntry.Key))
+						{
+							RectsToLock.Emplace(IndexEntry.Key);
+							bAreEntriesLocked = false;
+						}
+					}
+				});
+			OutResults.Add(HandlesToErase.Num() > FirstHandleIndex);
+		}
+		if (bAreEntriesLocked)
 		{
-			int64 const Index = IndexOffset + X;
-			SpatialGridData[Index].RemoveAllSwap([&Rect, &Predicate](FIndexEntry const & IndexEntry) -> bool { return Rect.Intersect(IndexEntry.Key) && Predicate(IndexEntry); });
+			// Entry overlapping several rects is erased once.
+			HandlesToErase.Sort();
+			HandlesToErase.SetNum(Algo::Unique(HandlesToErase), EAllowShrinking::No);
+			for (uint32 const Handle : HandlesToErase)
+			{
+				EraseNoLock(Handle, WRectsScopeLock.GetChunksNum());
+			}
+			return;
 		}
 	}
 }
@@ -208,143 +479,607 @@ void TUEConcurrentSpatialGridIndex<DataType>::EraseByPredicate(FIntRect const &
 template <typename DataType>
 TMap<FIntRect, DataType> TUEConcurrentSpatialGridIndex<DataType>::GetOverlapping(FIntRect const & Rect) const
 {
-	CheckRange(Rect);
 	TMap<FIntRect, DataType> OverlappingRectsInfo;
-	FIntRect const IndexCellsRect = FIntRect::DivideAndRoundUp(Rect, IndexCellSize);
-	
-	FRWRectScopeLock RRectScopeLock(*this, Rect, ERWLockType::ReadOnly);
-
-	for (int64 Y = IndexCellsRect.Min.Y; Y < IndexCellsRect.Max.Y; ++Y)
+	auto const AddOverlappingRectInfo = [&OverlappingRectsInfo](FIndexEntry const & IndexEntry)
+		{
+			OverlappingRectsInfo.Emplace(IndexEntry.Key, IndexEntry.Value);
+		};
+	if constexpr (TIsPODType<DataType>::Value)
 	{
-		int64 const IndexOffset = Y * IndexCellsNum.X;
-		for (int64 X = IndexCellsRect.Min.X; X < IndexCellsRect.Max.X; ++X)
+		for (int32 Attempt = 0; Attempt < OptimisticReadAttemptsNum; ++Attempt)
 		{
-			int64 const Index = IndexOffset + X;
-			for (FIndexEntry const & IndexEntry : SpatialGridData[Index])
+			if (TryForEachOverlappingOptimistic(Rect, AddOverlappingRectInfo))
 			{
-				if (Rect.Intersect(IndexEntry.Key))
-				{
-					OverlappingRectsInfo.Emplace(IndexEntry.Key, IndexEntry.Value);
-				}
+				return OverlappingRectsInfo;
 			}
+			OverlappingRectsInfo.Reset();
 		}
 	}
+	ForEachOverlapping(Rect, AddOverlappingRectInfo);
 	return OverlappingRectsInfo;
 }
 
 template <typename DataType>
-void TUEConcurrentSpatialGridIndex<DataType>::GetLocks(FIntRect const & Rect, ERWLockType const LockType) const
+template <typename AllocatorType>
+void TUEConcurrentSpatialGridIndex<DataType>::GetOverlapping(FIntRect const & Rect, TArray<DataType, AllocatorType> & OutData) const
 {
-	CheckRange(Rect);
-	FIntRect const LockCellsRect = Rect / LockCellSize;
-	for (int64 Y = LockCellsRect.Min.Y; Y <= LockCellsRect.Max.Y; ++Y)
+	auto const AddData = [&OutData](FIndexEntry const & IndexEntry)
+		{
+			OutData.Emplace(IndexEntry.Value);
+		};
+	if constexpr (TIsPODType<DataType>::Value)
 	{
-		int64 const IndexOffset = Y * LockCellsNum.X;
-		for (int64 X = LockCellsRect.Min.X; X <= LockCellsRect.Max.X; ++X)
+		int32 const FirstOutIndex = OutData.Num();
+		for (int32 Attempt = 0; Attempt < OptimisticReadAttemptsNum; ++Attempt)
 		{
-			int64 const Index = IndexOffset + X;
-			if (LockType == ERWLockType::ReadOnly)
-			{
-				Locks[Index].ReadLock();
-			}
-			else
+			if (TryForEachOverlappingOptimistic(Rect, AddData))
 			{
-				Locks[Index].WriteLock();
+				return;
 			}
+			OutData.SetNum(FirstOutIndex, EAllowShrinking::No);
 		}
 	}
+	ForEachOverlapping(Rect, AddData);
+}
+
+template <typename DataType>
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::ForEachOverlapping(FIntRect const & Rect, VisitorType && Visitor) const
+{
+	FRWRectsScopeLock RRectsScopeLock(*this, MakeArrayView(&Rect, 1), ERWLockType::ReadOnly);
+	ForEachOverlappingNoLock(Rect, RRectsScopeLock.GetChunksNum(), [this, &Visitor](uint32 const Handle)
+		{
+			Visitor(EntryPool[Handle]);
+		});
 }
 
 template <typename DataType>
-void TUEConcurrentSpatialGridIndex<DataType>::FreeLocks(FIntRect const & Rect, ERWLockType const LockType) const
+FIntPoint TUEConcurrentSpatialGridIndex<DataType>::DivideAndRoundDown(FIntPoint const Coords, FIntPoint const Divisor)
 {
-	CheckRange(Rect);
-	FIntRect const LockCellsRect = Rect / LockCellSize;
-	for (int64 Y = LockCellsRect.Max.Y; Y >= LockCellsRect.Min.Y; --Y)
+	FIntPoint const Quotient = Coords / Divisor;
+	return FIntPoint{ Quotient.X - (Coords.X % Divisor.X < 0 ? 1 : 0), Quotient.Y - (Coords.Y % Divisor.Y < 0 ? 1 : 0) };
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::AddChunks(FIntRect const & Rect)
+{
+	ForEachChunkCoords(Rect, [this](FIntPoint const ChunkCoords)
+		{
+			ChunkMap.FindOrAdd(ChunkCoords, IndexCellsNum, LockCellsNum);
+		});
+}
+
+template <typename DataType>
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::ForEachChunkCoords(FIntRect const & Rect, VisitorType && Visitor) const
+{
+	FIntPoint const LastCoords = Rect.Min.ComponentMax(Rect.Max - FIntPoint{ 1, 1 });
+	FIntPoint const FromChunkCoords = DivideAndRoundDown(Rect.Min, ChunkSize);
+	FIntPoint const ToChunkCoords = DivideAndRoundDown(LastCoords, ChunkSize);
+	for (int32 Y = FromChunkCoords.Y; Y <= ToChunkCoords.Y; ++Y)
 	{
-		int64 const IndexOffset = Y * LockCellsNum.X;
-		for (int64 X = LockCellsRect.Max.X; X >= LockCellsRect.Min.X; --X)
+		for (int32 X = FromChunkCoords.X; X <= ToChunkCoords.X; ++X)
+		{
+			Visitor(FIntPoint{ X, Y });
+		}
+	}
+}
+
+template <typename DataType>
+bool TUEConcurrentSpatialGridIndex<DataType>::HasChunksAddedAfter(FIntRect const & Rect, uint32 const VisibleChunksNum) const
+{
+	bool bHasChunksAddedAfter = false;
+	ForEachChunkCoords(Rect, [this, VisibleChunksNum, &bHasChunksAddedAfter](FIntPoint const ChunkCoords)
+		{
+			FChunk const * const Chunk = ChunkMap.Find(ChunkCoords);
+			bHasChunksAddedAfter |= Chunk && Chunk->Id >= VisibleChunksNum;
+		});
+	return bHasChunksAddedAfter;
+}
+
+template <typename DataType>
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::ForEachChunk(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const
+{
+	FIntPoint const LastCoords = Rect.Min.ComponentMax(Rect.Max - FIntPoint{ 1, 1 });
+	ForEachChunkCoords(Rect, [this, VisibleChunksNum, &Visitor, &Rect, LastCoords](FIntPoint const ChunkCoords)
 		{
-			int64 const Index = IndexOffset + X;
-			if (LockType == ERWLockType::ReadOnly)
+			FChunk * const Chunk = ChunkMap.Find(ChunkCoords);
+			if (Chunk && Chunk->Id < VisibleChunksNum)
 			{
-				Locks[Index].ReadUnlock();
+				FIntPoint const ChunkOrigin{ ChunkCoords.X * ChunkSize.X, ChunkCoords.Y * ChunkSize.Y };
+				Visitor(*Chunk, (Rect.Min - ChunkOrigin).ComponentMax(FIntPoint::ZeroValue), (LastCoords - ChunkOrigin).ComponentMin(ChunkSize - FIntPoint{ 1, 1 }));
 			}
-			else
+		});
+}
+
+template <typename DataType>
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::ForEachIndexCell(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const
+{
+	ForEachChunk(Rect, VisibleChunksNum, [this, &Visitor](FChunk & Chunk, FIntPoint const FirstCoords, FIntPoint const LastCoords)
+		{
+			FIntPoint const FromIndexCellCoords = FirstCoords / IndexCellSize;
+			FIntPoint const ToIndexCellCoords = LastCoords / IndexCellSize;
+			FIntPoint const ChunkIndexCellCoords{ Chunk.Coords.X * IndexCellsNum.X, Chunk.Coords.Y * IndexCellsNum.Y };
+			for (int32 Y = FromIndexCellCoords.Y; Y <= ToIndexCellCoords.Y; ++Y)
 			{
-				Locks[Index].WriteUnlock();
+				int32 const IndexOffset = Y * IndexCellsNum.X;
+				for (int32 X = FromIndexCellCoords.X; X <= ToIndexCellCoords.X; ++X)
+				{
+					Visitor(Chunk.Cells[IndexOffset + X], ChunkIndexCellCoords + FIntPoint{ X, Y });
+				}
 			}
-		}
+		});
+}
+
+template <typename DataType>
+bool TUEConcurrentSpatialGridIndex<DataType>::IsVisitedInIndexCell(FIntRect const & EntryRect, FIntRect const & Rect, FIntPoint const IndexCellCoords) const
+{
+	// Entry spanning several index cells is kept in all of them, the first one in Rect is the one containing corner of their intersection.
+	return DivideAndRoundDown(EntryRect.Min.ComponentMax(Rect.Min), IndexCellSize) == IndexCellCoords && Rect.Intersect(EntryRect);
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::AppendLockCells(FIntRect const & Rect, uint32 const VisibleChunksNum, FLockCells & OutLockCells) const
+{
+	ForEachChunk(Rect, VisibleChunksNum, [this, &OutLockCells](FChunk & Chunk, FIntPoint const FirstCoords, FIntPoint const LastCoords)
+		{
+			FIntPoint const FromLockCellCoords = FirstCoords / LockCellSize;
+			FIntPoint const ToLockCellCoords = LastCoords / LockCellSize;
+			for (int32 Y = FromLockCellCoords.Y; Y <= ToLockCellCoords.Y; ++Y)
+			{
+				int32 const IndexOffset = Y * LockCellsNum.X;
+				for (int32 X = FromLockCellCoords.X; X <= ToLockCellCoords.X; ++X)
+				{
+					int32 const Index = IndexOffset + X;
+					OutLockCells.Emplace(FLockCell{ static_cast<uint64>(Chunk.Id) << 32 | static_cast<uint32>(Index), &Chunk, Index });
+				}
+			}
+		});
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::SortLockCells(FLockCells & LockCells)
+{
+	LockCells.Sort([](FLockCell const & A, FLockCell const & B) { return A.Key < B.Key; });
+	LockCells.SetNum(Algo::Unique(LockCells, [](FLockCell const & A, FLockCell const & B) { return A.Key == B.Key; }), EAllowShrinking::No);
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::GetLock(FLockCell const & LockCell, ERWLockType const LockType) const
+{
+	if (LockType == ERWLockType::ReadOnly)
+	{
+		LockCell.Chunk->Locks[LockCell.Index].ReadLock();
+	}
+	else
+	{
+		LockCell.Chunk->Locks[LockCell.Index].WriteLock();
+		uint32 & LockSequence = LockCell.Chunk->LockSequences[LockCell.Index];
+		std::atomic_ref<uint32>(LockSequence).store(LockSequence + 1, std::memory_order_relaxed);
+	}
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FreeLock(FLockCell const & LockCell, ERWLockType const LockType) const
+{
+	if (LockType == ERWLockType::ReadOnly)
+	{
+		LockCell.Chunk->Locks[LockCell.Index].ReadUnlock();
+	}
+	else
+	{
+		uint32 & LockSequence = LockCell.Chunk->LockSequences[LockCell.Index];
+		std::atomic_ref<uint32>(LockSequence).store(LockSequence + 1, std::memory_order_release);
+		LockCell.Chunk->Locks[LockCell.Index].WriteUnlock();
 	}
 }
 
 template <typename DataType>
 template <typename ArgType>
-void TUEConcurrentSpatialGridIndex<DataType>::InsertUncheckedNoLock(FIntRect const & Rect, ArgType && Data)
+void TUEConcurrentSpatialGridIndex<DataType>::InsertUncheckedNoLock(FIntRect const & Rect, ArgType && Data, uint32 const VisibleChunksNum)
+{
+	uint32 const Handle = EntryPool.Allocate(Rect, Forward<ArgType>(Data));
+	ForEachIndexCell(Rect, VisibleChunksNum, [Handle](FCellInfo & Cell, FIntPoint const IndexCellCoords)
+		{
+			Cell.Add(Handle);
+		});
+}
+
+template <typename DataType>
+bool TUEConcurrentSpatialGridIndex<DataType>::CheckIfFreeNoLock(FIntRect const & Rect, uint32 const VisibleChunksNum) const
+{
+	bool IsFree = true;
+	ForEachIndexCell(Rect, VisibleChunksNum, [this, &Rect, &IsFree](FCellInfo const & Cell, FIntPoint const IndexCellCoords)
+		{
+			if (IsFree)
+			{
+				Cell.ForEachHandle([this, &Rect, &IsFree](uint32 const Handle)
+					{
+						IsFree = IsFree && !Rect.Intersect(EntryPool[Handle].Key);
+					});
+			}
+		});
+	return IsFree;
+}
+
+template <typename DataType>
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::ForEachOverlappingNoLock(FIntRect const & Rect, uint32 const VisibleChunksNum, VisitorType && Visitor) const
+{
+	ForEachIndexCell(Rect, VisibleChunksNum, [this, &Rect, &Visitor](FCellInfo const & Cell, FIntPoint const IndexCellCoords)
+		{
+			Cell.ForEachHandle([this, &Rect, &Visitor, IndexCellCoords](uint32 const Handle)
+				{
+					if (IsVisitedInIndexCell(EntryPool[Handle].Key, Rect, IndexCellCoords))
+					{
+						Visitor(Handle);
+					}
+				});
+		});
+}
+
+template <typename DataType>
+template <typename VisitorType>
+bool TUEConcurrentSpatialGridIndex<DataType>::TryForEachOverlappingOptimistic(FIntRect const & Rect, VisitorType && Visitor) const
 {
-	CheckRange(Rect);
-	FIntRect const IndexCellsRect = FIntRect::DivideAndRoundUp(Rect, IndexCellSize);
-	for (int64 Y = IndexCellsRect.Min.Y; Y < IndexCellsRect.Max.Y; ++Y)
+	uint32 const ChunksNum = ChunkMap.GetChunksNum();
+	FLockCells LockCells;
+	AppendLockCells(Rect, ChunksNum, LockCells);
+	TArray<uint32, TInlineAllocator<16>> Sequences;
+	for (FLockCell const & LockCell : LockCells)
 	{
-		int64 const IndexOffset = Y * IndexCellsNum.X;
-		for (int64 X = IndexCellsRect.Min.X; X < IndexCellsRect.Max.X; ++X)
+		uint32 const Sequence = std::atomic_ref<uint32>(LockCell.Chunk->LockSequences[LockCell.Index]).load(std::memory_order_acquire);
+		if (Sequence % 2 != 0)
 		{
-			int64 const Index = IndexOffset + X;
-			SpatialGridData[Index].Push({ Rect, Forward<ArgType>(Data) });
+			return false;
 		}
+		Sequences.Emplace(Sequence);
 	}
+
+	ForEachIndexCell(Rect, ChunksNum, [this, &Rect, &Visitor](FCellInfo const & Cell, FIntPoint const IndexCellCoords)
+		{
+			Cell.ForEachHandle([this, &Rect, &Visitor, IndexCellCoords](uint32 const Handle)
+				{
+					// Handle of erased entry is skipped, erasing it has changed sequence anyway.
+					FIndexEntry const * const IndexEntry = EntryPool.FindOptimistic(Handle);
+					if (IndexEntry)
+					{
+						FIntRect const EntryRect = IndexEntry->Key;
+						if (IsVisitedInIndexCell(EntryRect, Rect, IndexCellCoords))
+						{
+							Visitor(*IndexEntry);
+						}
+					}
+				});
+		});
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	for (int32 LockCellIndex = 0; LockCellIndex < LockCells.Num(); ++LockCellIndex)
+	{
+		FLockCell const & LockCell = LockCells[LockCellIndex];
+		if (std::atomic_ref<uint32>(LockCell.Chunk->LockSequences[LockCell.Index]).load(std::memory_order_relaxed) != Sequences[LockCellIndex])
+		{
+			return false;
+		}
+	}
+	// Entry inserted in a chunk of Rect added meanwhile might be missed, as it's visited in the first of its index cells in Rect.
+	// Chunks added outside of Rect don't matter, as entries are inserted only after all their chunks are added.
+	return !HasChunksAddedAfter(Rect, ChunksNum);
 }
 
 template <typename DataType>
-bool TUEConcurrentSpatialGridIndex<DataType>::CheckIfFreeNoLock(FIntRect const & Rect) const
+void TUEConcurrentSpatialGridIndex<DataType>::EraseNoLock(uint32 const Handle, uint32 const VisibleChunksNum)
 {
-	CheckRange(Rect);
-	FIntRect const IndexCellsRect = FIntRect::DivideAndRoundUp(Rect, IndexCellSize);
-	bool IsFree = true;
-	for (int64 Y = IndexCellsRect.Min.Y; Y < IndexCellsRect.Max.Y; ++Y)
+	ForEachIndexCell(EntryPool[Handle].Key, VisibleChunksNum, [Handle](FCellInfo & Cell, FIntPoint const IndexCellCoords)
+		{
+			Cell.Remove(Handle);
+		});
+	EntryPool.Free(Handle);
+}
+
+template <typename DataType>
+TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::FRWRectsScopeLock(TUEConcurrentSpatialGridIndex<DataType> const & InSpatialGridIndex, TConstArrayView<FIntRect> const Rects, ERWLockType const InLockType)
+	: SpatialGridIndex(InSpatialGridIndex)
+	, LockType(InLockType)
+{
+	while (true)
 	{
-		int64 const IndexOffset = Y * IndexCellsNum.X;
-		for (int64 X = IndexCellsRect.Min.X; X < IndexCellsRect.Max.X; ++X)
+		ChunksNum = SpatialGridIndex.ChunkMap.GetChunksNum();
+		LockCells.Reset();
+		for (FIntRect const & Rect : Rects)
+		{
+			SpatialGridIndex.AppendLockCells(Rect, ChunksNum, LockCells);
+		}
+		SortLockCells(LockCells);
+		GetLocks();
+		// Entry might have been inserted meanwhile in a chunk of Rects which isn't locked. Chunks added outside of Rects don't
+		// matter, as writers add all chunks of their rects before locking, see also IsLocked.
+		bool bHasChunksAddedAfter = false;
+		for (FIntRect const & Rect : Rects)
+		{
+			bHasChunksAddedAfter |= SpatialGridIndex.HasChunksAddedAfter(Rect, ChunksNum);
+		}
+		if (!bHasChunksAddedAfter)
 		{
-			int64 const Index = IndexOffset + X;
-			for (FIndexEntry const & IndexEntry : SpatialGridData[Index])
+			break;
+		}
+		FreeLocks();
+	}
+}
+
+template <typename DataType>
+TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::~FRWRectsScopeLock()
+{
+	FreeLocks();
+}
+
+template <typename DataType>
+uint32 TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::GetChunksNum() const
+{
+	return ChunksNum;
+}
+
+template <typename DataType>
+bool TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::IsLocked(FIntRect const & Rect) const
+{
+	// Entry found in locked cells may also lie in chunks added after locks were taken, which aren't locked.
+	if (SpatialGridIndex.HasChunksAddedAfter(Rect, ChunksNum))
+	{
+		return false;
+	}
+	FLockCells RectLockCells;
+	SpatialGridIndex.AppendLockCells(Rect, ChunksNum, RectLockCells);
+	for (FLockCell const & LockCell : RectLockCells)
+	{
+		if (Algo::BinarySearchBy(LockCells, LockCell.Key, &FLockCell::Key) == INDEX_NONE)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::GetLocks() const
+{
+	for (FLockCell const & LockCell : LockCells)
+	{
+		SpatialGridIndex.GetLock(LockCell, LockType);
+	}
+	if (LockType == ERWLockType::Write)
+	{
+		// Odd sequences are seen by optimistic readers before any change.
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FRWRectsScopeLock::FreeLocks() const
+{
+	for (int32 LockCellIndex = LockCells.Num() - 1; LockCellIndex >= 0; --LockCellIndex)
+	{
+		SpatialGridIndex.FreeLock(LockCells[LockCellIndex], LockType);
+	}
+}
+
+template <typename DataType>
+TUEConcurrentSpatialGridIndex<DataType>::FChunk::FChunk(FIntPoint const InCoords, uint32 const InId, FIntPoint const IndexCellsNum, FIntPoint const LockCellsNum)
+	: Coords(InCoords)
+	, Id(InId)
+{
+	Cells.SetNum(IndexCellsNum.X * IndexCellsNum.Y);
+	Locks.SetNum(LockCellsNum.X * LockCellsNum.Y);
+	LockSequences.SetNumZeroed(LockCellsNum.X * LockCellsNum.Y);
+}
+
+template <typename DataType>
+typename TUEConcurrentSpatialGridIndex<DataType>::FChunk * TUEConcurrentSpatialGridIndex<DataType>::FChunkMap::Find(FIntPoint const ChunkCoords) const
+{
+	TArray<FChunk *> const * const Table = std::atomic_ref<TArray<FChunk *> *>(const_cast<TArray<FChunk *> *&>(CurrentTable)).load(std::memory_order_acquire);
+	if (!Table)
+	{
+		return nullptr;
+	}
+	uint32 const SlotIndexMask = Table->Num() - 1;
+	for (uint32 SlotIndex = GetTypeHash(ChunkCoords) & SlotIndexMask; ; SlotIndex = (SlotIndex + 1) & SlotIndexMask)
+	{
+		FChunk * const Chunk = std::atomic_ref<FChunk *>(const_cast<FChunk *&>((*Table)[SlotIndex])).load(std::memory_order_acquire);
+		if (!Chunk || Chunk->Coords == ChunkCoords)
+		{
+			return Chunk;
+		}
+	}
+}
+
+template <typename DataType>
+typename TUEConcurrentSpatialGridIndex<DataType>::FChunk * TUEConcurrentSpatialGridIndex<DataType>::FChunkMap::FindOrAdd(FIntPoint const ChunkCoords, FIntPoint const IndexCellsNum, FIntPoint const LockCellsNum)
+{
+	// Chunk is published in table before it's counted, so chunk which isn't counted yet is waited for under critical section.
+	// Otherwise scope lock taken right after might not see the chunk and entry would be inserted without its index cells.
+	FChunk * const FoundChunk = Find(ChunkCoords);
+	if (FoundChunk && FoundChunk->Id < GetChunksNum())
+	{
+		return FoundChunk;
+	}
+	FScopeLock ScopeLock(&CriticalSection);
+	// Chunk may have been added by other thread meanwhile.
+	if (FChunk * const Chunk = Find(ChunkCoords))
+	{
+		return Chunk;
+	}
+	FChunk * const Chunk = Chunks.Emplace_GetRef(MakeUnique<FChunk>(ChunkCoords, ChunksNum, IndexCellsNum, LockCellsNum)).Get();
+	if (!CurrentTable || (Chunks.Num() * 2 > CurrentTable->Num()))
+	{
+		TUniquePtr<TArray<FChunk *>> Table = MakeUnique<TArray<FChunk *>>();
+		Table->SetNumZeroed(CurrentTable ? CurrentTable->Num() * 2 : MinTableSize);
+		for (TUniquePtr<FChunk> const & AddedChunk : Chunks)
+		{
+			AddToTable(*Table, AddedChunk.Get());
+		}
+		std::atomic_ref<TArray<FChunk *> *>(CurrentTable).store(Tables.Emplace_GetRef(MoveTemp(Table)).Get(), std::memory_order_release);
+	}
+	else
+	{
+		AddToTable(*CurrentTable, Chunk);
+	}
+	std::atomic_ref<uint32>(ChunksNum).store(ChunksNum + 1, std::memory_order_release);
+	return Chunk;
+}
+
+template <typename DataType>
+uint32 TUEConcurrentSpatialGridIndex<DataType>::FChunkMap::GetChunksNum() const
+{
+	return std::atomic_ref<uint32>(const_cast<uint32 &>(ChunksNum)).load(std::memory_order_acquire);
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FChunkMap::AddToTable(TArray<FChunk *> & Table, FChunk * const Chunk)
+{
+	uint32 const SlotIndexMask = Table.Num() - 1;
+	uint32 SlotIndex = GetTypeHash(Chunk->Coords) & SlotIndexMask;
+	while (Table[SlotIndex])
+	{
+		SlotIndex = (SlotIndex + 1) & SlotIndexMask;
+	}
+	std::atomic_ref<FChunk *>(Table[SlotIndex]).store(Chunk, std::memory_order_release);
+}
+
+template <typename DataType>
+template <typename ArgType>
+uint32 TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::Allocate(FIntRect const & Rect, ArgType && Data)
+{
+	uint32 Handle = 0;
+	{
+		FScopeLock ScopeLock(&CriticalSection);
+		if (!FreeHandles.IsEmpty())
+		{
+			Handle = FreeHandles.Pop(EAllowShrinking::No);
+		}
+		else
+		{
+			Handle = UsedSlotsNum;
+			uint32 const SlabIndex = Handle >> SlabSizeLog2;
+			check(SlabIndex < MaxSlabsNum);
+			if (!Slabs[SlabIndex])
 			{
-				if (Rect.Intersect(IndexEntry.Key))
-				{
-					IsFree = false;
-					goto EndLoop;
-				}
+				Slabs[SlabIndex] = MakeUnique<TOptional<FIndexEntry>[]>(SlabSize);
 			}
+			// Slab is published to optimistic readers with the slot number.
+			std::atomic_ref<uint32>(UsedSlotsNum).store(Handle + 1, std::memory_order_release);
 		}
 	}
-EndLoop:
-	return IsFree;
+	// Optimistic readers may still read a reused slot through a handle they found before it was erased, while it's written here.
+	// Erasing has changed sequence of their lock cells, so their results are dropped, but they might have read torn entry.
+	GetSlot(Handle).Emplace(Rect, Forward<ArgType>(Data));
+	return Handle;
 }
 
 template <typename DataType>
-void TUEConcurrentSpatialGridIndex<DataType>::CheckRange(FIntPoint const Coords) const
+void TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::Free(uint32 const Handle)
 {
-	check((Coords.X >= 0) && (Coords.X < Size.X) && (Coords.Y >= 0) && (Coords.Y < Size.Y));
+	GetSlot(Handle).Reset();
+	FScopeLock ScopeLock(&CriticalSection);
+	FreeHandles.Push(Handle);
 }
 
 template <typename DataType>
-void TUEConcurrentSpatialGridIndex<DataType>::CheckRange(FIntRect const & Rect) const
+typename TUEConcurrentSpatialGridIndex<DataType>::FIndexEntry & TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::operator[](uint32 const Handle)
 {
-	CheckRange(Rect.Min);
-	CheckRange(Rect.Max);
+	return GetSlot(Handle).GetValue();
 }
 
 template <typename DataType>
-TUEConcurrentSpatialGridIndex<DataType>::FRWRectScopeLock::FRWRectScopeLock(TUEConcurrentSpatialGridIndex<DataType> const & InSpatialGridIndex, FIntRect const & InRect, ERWLockType const InLockType)
-	: SpatialGridIndex(InSpatialGridIndex)
-	, Rect(InRect)
-	, LockType(InLockType)
+typename TUEConcurrentSpatialGridIndex<DataType>::FIndexEntry const & TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::operator[](uint32 const Handle) const
+{
+	return Slabs[Handle >> SlabSizeLog2][Handle & (SlabSize - 1)].GetValue();
+}
+
+template <typename DataType>
+typename TUEConcurrentSpatialGridIndex<DataType>::FIndexEntry const * TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::FindOptimistic(uint32 const Handle) const
+{
+	if (Handle >= std::atomic_ref<uint32>(const_cast<uint32 &>(UsedSlotsNum)).load(std::memory_order_acquire))
+	{
+		return nullptr;
+	}
+	return Slabs[Handle >> SlabSizeLog2][Handle & (SlabSize - 1)].GetPtrOrNull();
+}
+
+template <typename DataType>
+TOptional<typename TUEConcurrentSpatialGridIndex<DataType>::FIndexEntry> & TUEConcurrentSpatialGridIndex<DataType>::FEntryPool::GetSlot(uint32 const Handle)
+{
+	return Slabs[Handle >> SlabSizeLog2][Handle & (SlabSize - 1)];
+}
+
+template <typename DataType>
+TUEConcurrentSpatialGridIndex<DataType>::FCellInfo::~FCellInfo()
+{
+	while (FirstBlock)
+	{
+		FHandlesBlock * const Block = FirstBlock;
+		FirstBlock = Block->Next;
+		delete Block;
+	}
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FCellInfo::Add(uint32 const Handle)
+{
+	FHandlesBlock ** BlockPtr = &FirstBlock;
+	for (uint32 BlockIndex = 0; ; ++BlockIndex)
+	{
+		if (!*BlockPtr)
+		{
+			// Blocks stay allocated when cell gets emptier, so a new one is only needed at the end of the list.
+			std::atomic_ref<FHandlesBlock *>(*BlockPtr).store(new FHandlesBlock, std::memory_order_release);
+		}
+		if (BlockIndex == HandlesNum / FHandlesBlock::Capacity)
+		{
+			break;
+		}
+		BlockPtr = &(*BlockPtr)->Next;
+	}
+	std::atomic_ref<uint32>((*BlockPtr)->Handles[HandlesNum % FHandlesBlock::Capacity]).store(Handle, std::memory_order_relaxed);
+	std::atomic_ref<uint32>(HandlesNum).store(HandlesNum + 1, std::memory_order_relaxed);
+}
+
+template <typename DataType>
+void TUEConcurrentSpatialGridIndex<DataType>::FCellInfo::Remove(uint32 const Handle)
 {
-	SpatialGridIndex.GetLocks(Rect, LockType);
+	uint32 * HandlePtr = nullptr;
+	uint32 * LastHandlePtr = nullptr;
+	uint32 Position = 0;
+	for (FHandlesBlock * Block = FirstBlock; Block && Position < HandlesNum; Block = Block->Next)
+	{
+		for (uint32 BlockPosition = 0; BlockPosition < FHandlesBlock::Capacity && Position < HandlesNum; ++BlockPosition, ++Position)
+		{
+			if (Block->Handles[BlockPosition] == Handle)
+			{
+				HandlePtr = &Block->Handles[BlockPosition];
+			}
+			LastHandlePtr = &Block->Handles[BlockPosition];
+		}
+	}
+	check(HandlePtr);
+	std::atomic_ref<uint32>(*HandlePtr).store(*LastHandlePtr, std::memory_order_relaxed);
+	std::atomic_ref<uint32>(HandlesNum).store(HandlesNum - 1, std::memory_order_relaxed);
 }
 
 template <typename DataType>
-TUEConcurrentSpatialGridIndex<DataType>::FRWRectScopeLock::~FRWRectScopeLock()
+template <typename VisitorType>
+void TUEConcurrentSpatialGridIndex<DataType>::FCellInfo::ForEachHandle(VisitorType && Visitor) const
 {
-	SpatialGridIndex.FreeLocks(Rect, LockType);
-}
\ No newline at end of file
+	// Atomic reads make walking safe for optimistic readers, under locks they are plain reads anyway.
+	uint32 const Num = std::atomic_ref<uint32>(const_cast<uint32 &>(HandlesNum)).load(std::memory_order_relaxed);
+	uint32 Position = 0;
+	for (FHandlesBlock * Block = std::atomic_ref<FHandlesBlock *>(const_cast<FHandlesBlock *&>(FirstBlock)).load(std::memory_order_acquire);
+		Block && Position < Num;
+		Block = std::atomic_ref<FHandlesBlock *>(Block->Next).load(std::memory_order_acquire))
+	{
+		for (uint32 BlockPosition = 0; BlockPosition < FHandlesBlock::Capacity && Position < Num; ++BlockPosition, ++Position)
+		{
+			Visitor(std::atomic_ref<uint32>(Block->Handles[BlockPosition]).load(std::memory_order_relaxed));
+		}
+	}
+}
@@ -7,7 +7,10 @@
 #include "UEGridComponent.generated.h"
 
 enum class EUEGridLayer : uint8;
-class FUEGridLayer;
+enum class EUEGridLayerOperation : uint8;
+template <typename InWordType, uint32 InNumWordsPerTile>
+class TUEGridLayer;
+using FUEGridLayer = TUEGridLayer<uint32, 16>;
 
 UCLASS(Blueprintable, ClassGroup = (Custom), HideCategories = (Activation, Collision, Cooking, HLOD, Mobility, LOD, Navigation, Object, Physics))
 class UNDEADEMPIRE_API UUEGridComponent : public USceneComponent
@@ -21,6 +24,11 @@ public:
 	virtual void OnRegister() override;
 	virtual void OnUnregister() override;
 	virtual FBoxSphereBounds CalcBounds(FTransform const & LocalToWorld) const override;
+	virtual void GetResourceSizeEx(FResourceSizeEx & CumulativeResourceSize) override;
+#if WITH_EDITOR
+	/** Warns if baked nature obstacle layer is outdated, so that it's not traced on every BeginPlay unnoticed. */
+	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+#endif
 
 	FIntPoint GetGridSize() const;
 	FIntRect const & GetGridRect() const;
@@ -29,11 +37,18 @@ public:
 	/** Checks if cell containing point Coords is occupied. */
 	bool IsCellOccupied(EUEGridLayer const GridLayer, FVector2D const Coords) const;
 	bool IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint const CellCoords) const;
+	/** Appends to OutIsOccupied occupation of CellsCoords, bit per cell. Cells outside of grid are not occupied. */
+	void IsCellsOccupied(EUEGridLayer const GridLayer, TConstArrayView<FIntPoint> const CellsCoords, TBitArray<> & OutIsOccupied) const;
+	/** Sets bits of occupied cells of OutMask, which is row-major mask of cells in MaskRect. Other bits are not changed. */
+	void ExtractRectMask(EUEGridLayer const GridLayer, FIntRect const & MaskRect, TBitArray<> & OutMask) const;
 
 	/** Sets cell containing point Coords state. */
 	bool SetCellState(EUEGridLayer const GridLayer, FVector2D const Coords, bool const bIsOccupied);
 	bool SetCellState(EUEGridLayer const GridLayer, FIntPoint const CellCoords, bool const bIsOccupied);
 
+	/** Checks if cell is blocked for paths placed on PathGridLayer: it is nature obstacle or construction which is not such path. */
+	bool IsCellBlockedForPath(EUEGridLayer const PathGridLayer, FIntPoint const CellCoords) const;
+
 	/** Checks if specified rectangle is containing occupied cell. */
 	bool HasOccupiedCell(EUEGridLayer const GridLayer, FBox2D const & Rect) const;
 	bool HasOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
@@ -42,19 +57,68 @@ public:
 	void SetCellsState(EUEGridLayer const GridLayer, FBox2D const & Rect, bool const bIsOccupied);
 	void SetCellsState(EUEGridLayer const GridLayer, FIntRect const & Rect, bool const bIsOccupied);
 
+	/** Counts occupied cells in specified rectangle. */
+	int64 CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
+
+	/** Calls Visitor for each occupied cell in specified rectangle. Cost depends on number of occupied cells, not on rectangle area. */
+	void ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const;
+
+	/** Appends to OutAnchors minimum corners of all Size rectangles inside Rect with no occupied cells in any of GridLayersToCheck. */
+	void FindFreeRects(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, TArray<FIntPoint> & OutAnchors) const;
+	/** Finds minimum corner nearest to DesiredAnchor of Size rectangle inside Rect with no occupied cells in any of GridLayersToCheck. */
+	bool FindNearestFreeRect(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, FIntPoint const DesiredAnchor, FIntPoint & OutAnchor) const;
+
+	/** Appends rectangles containing all cells of GridLayer changed after SinceGeneration, see FUEGridLayer::GetCurrentGeneration. */
+	void GetChangedRects(EUEGridLayer const GridLayer, uint64 const SinceGeneration, TArray<FIntRect> & OutRects) const;
+
+	/** Makes InOutLayersCopy copy of grid layers, given that it was their copy at SinceGeneration, see FUEGridLayer::CopyChangedTiles. Empty copy gets all layers. */
+	void UpdateLayersCopy(TArray<FUEGridLayer> & InOutLayersCopy, uint64 const SinceGeneration) const;
+
+	/** Sets cells of DestinationGridLayer in specified rectangle to SourceGridLayerA Operation SourceGridLayerB. */
+	void CombineLayers(EUEGridLayer const DestinationGridLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect);
+	/** Creates empty sparse layer to combine grid layers into. Its cell coords are relative to GetGridRect().Min. */
+	FUEGridLayer CreateScratchLayer() const;
+	/** Sets cells of ScratchLayer in specified rectangle to SourceGridLayerA Operation SourceGridLayerB, e.g. buildable cells with NatureObstacle Nor Construction. */
+	void CombineLayers(FUEGridLayer & ScratchLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect) const;
+
+#if WITH_EDITOR
+	/** Traces nature obstacle layer and stores it compressed, so that BeginPlay only has to decompress it. */
+	void BakeNatureObstacleLayer();
+#endif
+
 protected:
+	/** Traces nature obstacle layer in a way selected by UE.Grid.NatureObstacleLayerFillMode. */
 	void FillNatureObstacleLayer();
+	void FillNatureObstacleLayerSerially();
+	/** Traces heights of cell corners on worker threads, then classifies cells by whole layer words. */
+	void FillNatureObstacleLayerInParallel();
+	/** Loads baked nature obstacle layer. Fails if there is none or it is outdated. */
+	bool LoadBakedNatureObstacleLayer();
+	/** Checks if layers are to be kept in grid system while component is streamed out. */
+	bool ShouldStreamGridLayers() const;
+	/** Takes layers restored by grid system, or fills them if they could not be restored, and registers component in grid system. */
+	void FinishStreamingInGridLayers(TArray<FUEGridLayer> && StreamedInGridLayers);
+	/** Updates cells in Rect of layers blocked for paths after change of ChangedGridLayer. */
+	void UpdatePathBlockingLayers(EUEGridLayer const ChangedGridLayer, FIntRect const & Rect);
 	FUEGridLayer & GetLayer(EUEGridLayer const GridLayer);
 	FUEGridLayer const & GetLayer(EUEGridLayer const GridLayer) const;
+	TArray<FUEGridLayer const *> GetLayers(TConstArrayView<EUEGridLayer> const GridLayersToCheck) const;
 	/** Converts coords to be used with UEGridLayer. */
 	FUintPoint GetUnsignedCellCoordsUnsafe(FIntPoint const SignedCellCoords) const;
 	FUintRect GetUnsignedRectUnsafe(FIntRect const & SignedRect) const;
 
 private:
 	double GetGridCellCornerZUnsafe(FIntPoint const Coords, UWorld const * const World, double const GridCellSize) const;
+	/**
+	 * Hashes everything nature obstacle layer depends on: heightfields of landscape collision overlapping grid and obstacle settings.
+	 * Other geometry is sampled with a coarse lattice of traces, not with all cell corners.
+	 */
+	uint32 CalculateNatureObstacleLayerHash(UWorld const * const World) const;
 
 protected:
 	TArray<FUEGridLayer> GridLayers;
+	/** Cells blocked for paths, NatureObstacle | (Construction & ~PathGridLayer), per layer paths are placed on. */
+	TArray<FUEGridLayer> PathBlockingLayers;
 	FIntRect GridRect;
 
 	// Difference of cell corner Z from mean(of all 4 corners) for cell to be considered an obstacle.
@@ -68,4 +132,30 @@ protected:
 	// The channel used to fill nature obstacle layer.
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "UE|Obstacles Calculation")
 	TEnumAsByte<ECollisionChannel> GroundTraceChannel;
+
+	// Layers which are mostly empty or full. Their tiles are allocated only when they get mixed cells.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "UE|Memory")
+	TArray<EUEGridLayer> SparseGridLayers;
+
+	// Compressed nature obstacle layer traced in editor. Used on BeginPlay while its hash matches.
+	UPROPERTY()
+	TArray<uint8> BakedNatureObstacleLayer;
+
+	UPROPERTY()
+	int32 BakedNatureObstacleLayerUncompressedSize;
+
+	UPROPERTY()
+	uint32 BakedNatureObstacleLayerHash;
+
+	// Keep layers compressed in grid system while component is streamed out, e.g. with its world partition cell, and restore them on stream in.
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "UE|Streaming")
+	bool bStreamGridLayers;
+
+private:
+	/** Component is registered in grid system only after its layers are streamed in. */
+	bool bIsStreamingInGridLayers;
+	/** Layers streamed in, or being streamed in, for current registration don't need nature obstacle layer to be filled. */
+	bool bAreGridLayersStreamedIn;
+	/** Changed on every unregistration, so that layers streamed in for previous registration are not taken. */
+	uint32 RegistrationSerial;
 };
@@ -4,59 +4,330 @@
 
 #include "CoreMinimal.h"
 
-class UNDEADEMPIRE_API FUEGridLayer
+/** Boolean operation to combine cells of two grid layers A and B. */
+enum class EUEGridLayerOperation : uint8
+{
+	And,
+	Or,
+	/** A & ~B. */
+	AndNot,
+	Xor,
+	/** ~(A | B). */
+	Nor
+};
+
+/**
+ * Grid of cells, one bit per cell, stored in tiles of InNumWordsPerTile column words. Word covers sizeof(InWordType) * 8 cells along Y,
+ * so tile shape is InNumWordsPerTile x (sizeof(InWordType) * 8) cells. Shapes are instantiated in UEGridLayer.cpp, see FUEGridLayer.
+ */
+template <typename InWordType, uint32 InNumWordsPerTile>
+class TUEGridLayer
 {
 public:
+	using WordType = InWordType;
+	static constexpr uint32 NumWordsPerTile = InNumWordsPerTile;
+
+	/** How tiles of layer are stored. */
+	enum class EStorage : uint8
+	{
+		/** Every tile is allocated up front. */
+		Dense,
+		/** Tiles with all cells in the same state share one read-only tile, other tiles are allocated on write. */
+		Sparse
+	};
+
+	/** How layer may be accessed from several threads. */
+	enum class EAccess : uint8
+	{
+		/** Writes must not run concurrently with any other access. */
+		Exclusive,
+		/**
+		 * SetCell, SetCells and reads of cells (GetCell, Contains, CountCells, ForEachCell) may run concurrently, as every word is
+		 * changed with atomic fetch_or / fetch_and and read with relaxed atomic load. Tile summaries cannot follow such changes,
+		 * so they are not kept and queries always read words. Requires dense storage. Multi-word writes (Combine,
+		 * SetCellsToUnionWithDifference, Erode, Dilate, SetAllCells, CopyChangedTiles) hold FScopedRowsLock of rows they change
+		 * and change words atomically too, so they must not be called while the caller holds FScopedRowsLock of the same layer.
+		 * Serialize and copying of whole layer must not run concurrently with any other access.
+		 */
+		Concurrent
+	};
+
+	/** Order of tiles in memory of dense storage. Tiles of sparse storage are allocated in order of writes. */
+	enum class ETileOrder : uint8
+	{
+		/** Tiles of a row follow each other, so rows of tiles are a whole row apart. */
+		RowMajor,
+		/**
+		 * Tiles follow Z-order curve, so near tiles are near in memory along both axes, which suits square rectangles
+		 * such as footprints and neighbourhoods. Queries visit tiles in the same order.
+		 */
+		Morton
+	};
+
 	/**
 	 * Sets size of layer.
-	 * @param InSize - X and Y will be padded to be multiple of NumWordsPerTile and NumBitsPerDWORD accordingly.
+	 * @param InSize - X and Y will be padded to be multiple of NumWordsPerTile and NumCellsPerColumnWord accordingly.
 	 */
-	explicit FUEGridLayer(FUintPoint const InSize);
+	explicit TUEGridLayer(FUintPoint const InSize, EStorage const InStorage = EStorage::Dense, EAccess const InAccess = EAccess::Exclusive, ETileOrder const InTileOrder = ETileOrder::RowMajor);
+
+	/**
+	 * Locks stripes of tile rows of concurrent layer covering Rect, for multi-word transactions such as check and set.
+	 * Stripes are locked in ascending order, so transactions do not deadlock. Does nothing for exclusive layer.
+	 */
+	class FScopedRowsLock
+	{
+	public:
+		UE_NODISCARD_CTOR explicit FScopedRowsLock(TUEGridLayer const & InGridLayer, FUintRect const & Rect, FRWScopeLockType const InLockType);
+		~FScopedRowsLock();
+		UE_NONCOPYABLE(FScopedRowsLock)
+
+	private:
+		TUEGridLayer const & GridLayer;
+		uint64 StripesMask;
+		FRWScopeLockType const LockType;
+	};
+
+	/** Reference to a grid cell. Assignment goes through SetCell, so per tile bookkeeping stays up to date. */
+	class FCellReference
+	{
+	public:
+		FCellReference(TUEGridLayer & InGridLayer, FUintPoint const InCoords);
+
+		operator bool() const;
+		FCellReference & operator =(bool const bValue);
 
-	FBitReference operator [](FUintPoint const Coords);
-	FConstBitReference const operator [](FUintPoint const Coords) const;
+	private:
+		TUEGridLayer & GridLayer;
+		FUintPoint const Coords;
+	};
+
+	FCellReference operator [](FUintPoint const Coords);
+	bool operator [](FUintPoint const Coords) const;
 
 	/** Returns state of a grid cell. */
 	bool GetCell(FUintPoint const Coords) const;
+	/** Sets state of a grid cell. */
+	void SetCell(FUintPoint const Coords, bool const bValue);
 
 	bool Contains(FUintRect const & Rect, bool const bValue) const;
 	void SetCells(FUintRect const & Rect, bool const bValue);
+	/**
+	 * Sets cells in Rect to SourceA Operation SourceB, SIMD over tile words. Tiles with uniform result are resolved by tile summaries.
+	 * All layers must have the same size, layer may be one of sources.
+	 */
+	void Combine(TUEGridLayer const & SourceA, TUEGridLayer const & SourceB, EUEGridLayerOperation const Operation, FUintRect const & Rect);
+	/** Sets cells in Rect to UnitedLayer | (MinuendLayer & ~SubtrahendLayer), word by word. All layers must have the same size. */
+	void SetCellsToUnionWithDifference(FUintRect const & Rect, TUEGridLayer const & UnitedLayer, TUEGridLayer const & MinuendLayer, TUEGridLayer const & SubtrahendLayer);
+	/**
+	 * Morphological erosion: sets each cell to whether all cells of Source in BoxSize rectangle with minimum corner at it are set.
+	 * Cells outside of layer are considered unset, so rectangles crossing layer border give unset cells. Source may be this layer.
+	 */
+	void Erode(TUEGridLayer const & Source, FUintPoint const BoxSize);
+	/** Morphological dilation: sets each cell to whether any cell of Source in BoxSize rectangle with minimum corner at it is set. */
+	void Dilate(TUEGridLayer const & Source, FUintPoint const BoxSize);
+
+	/** Returns number of cells with bValue state in specified rectangle. */
+	uint64 CountCells(FUintRect const & Rect, bool const bValue) const;
+	/**
+	 * Calls Visitor for each cell with bValue state in specified rectangle. Cost depends on number of such cells, not on rectangle area.
+	 * Visitor may change cells, but changes of not yet visited cells may be missed.
+	 */
+	void ForEachCell(FUintRect const & Rect, bool const bValue, TFunctionRef<void (FUintPoint const)> Visitor) const;
+
+	/** Number of cells along Y packed into one word of column words. */
+	static constexpr uint32 NumCellsPerColumnWord = sizeof(WordType) * 8;
+	/**
+	 * Overwrites all cells of layer. Word WordIndex of column X is ColumnsWords[X * GetYSize() / NumCellsPerColumnWord + WordIndex],
+	 * its bit Bit is state of cell { X, WordIndex * NumCellsPerColumnWord + Bit }.
+	 */
+	void SetAllCells(TConstArrayView<WordType> const ColumnsWords);
+
+	/**
+	 * Appends to OutAnchors anchors (minimum corners) of all RectSize rectangles lying in Rect which have no set cells in any of Layers.
+	 * Free cells of the layers are eroded by RectSize with shifted ANDs of whole words, so cost is linear in number of words in Rect
+	 * times logarithm of RectSize. All layers must have the same size.
+	 */
+	static void FindFreeRects(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, TArray<FUintPoint> & OutAnchors);
+	/**
+	 * Same as FindFreeRects, but finds only the anchor nearest to DesiredAnchor. DesiredAnchor may lie outside of the layers.
+	 * @return false if there is no free RectSize rectangle in Rect.
+	 */
+	static bool FindNearestFreeRect(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, FIntPoint const DesiredAnchor, FUintPoint & OutAnchor);
 
 	/** Size getters. */
 	FUintPoint GetSize() const;
 	uint32 GetXSize() const;
 	uint32 GetYSize() const;
 
+	EStorage GetStorage() const;
+	EAccess GetAccess() const;
+	ETileOrder GetTileOrder() const;
+
+	/**
+	 * Returns generation of the latest change of any layer. Every change of a tile gets next generation of the counter shared by all layers,
+	 * so value returned now can be passed to GetChangedRects later to get changes made after this call.
+	 */
+	static uint64 GetCurrentGeneration();
+	/** Appends rectangles of tiles changed after SinceGeneration, merging adjacent tiles along X. Cost depends on number of changes. */
+	void GetChangedRects(uint64 const SinceGeneration, TArray<FUintRect> & OutRects) const;
+	/**
+	 * Makes layer a copy of Source, given that it was a copy of Source at SinceGeneration: only tiles changed after it are copied,
+	 * with their generations. Whole layer is copied if Source was resized or has other storage, access or tile order.
+	 * Source must not be changed during copy.
+	 */
+	void CopyChangedTiles(TUEGridLayer const & Source, uint64 const SinceGeneration);
+
+	/** Returns number of bytes allocated by layer. */
+	SIZE_T GetAllocatedSize() const;
+
+	/**
+	 * Serializes size and cells of layer. Only tiles with mixed cells are written, uniform ones are restored from tile summaries.
+	 * Storage is not serialized, loaded layer keeps its own. Data of different tile shapes are not compatible.
+	 */
+	void Serialize(FArchive & Ar);
+
 private:
-	using WordType = uint32;
-	static constexpr uint32 NumWordsPerTile = 16;
 	static constexpr uint32 NumBitsPerWord = sizeof(WordType) * 8;
-	static constexpr WordType FullWordMask = ~0u;
+	static_assert(NumBitsPerWord == NumCellsPerColumnWord);
+	static constexpr WordType FullWordMask = ~WordType{ 0 };
+	/** Tiles up to 64 bytes are aligned to their size, so that none of them crosses cache line of most modern CPUs. */
+	static constexpr SIZE_T TileAlignment = sizeof(WordType) * NumWordsPerTile < 64 ? sizeof(WordType) * NumWordsPerTile : 64;
 
-	/** Tile of grid. Contains info about 16 x 32 grid cells. 64 bytes to fit in one cache line of most modern CPUs. */
-	struct alignas(64) FGridTile
+	/** Tile of grid. Contains info about NumWordsPerTile x NumBitsPerWord grid cells. */
+	struct alignas(TileAlignment) FGridTile
 	{
 	public:
 		/** Necessary for TArray specialization. */
 		FGridTile(FGridTile const & GridTile) noexcept;
+		FGridTile & operator =(FGridTile const & GridTile) noexcept = default;
 
-		FBitReference operator [](FUintPoint const Coords);
-		FConstBitReference const operator [](FUintPoint const Coords) const;
-		
 		bool Contains(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const;
 		void SetCells(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue);
+		/** Sets cells with atomic fetch_or / fetch_and per word. Returns if any cell was changed. */
+		bool SetCellsAtomically(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue);
+		/** Sets cells of Mask in word to Cells with atomic fetch_or and fetch_and, keeping other cells. Returns if any cell was changed. */
+		bool SetCellsWordAtomically(uint32 const WordIndex, WordType const Mask, WordType const Cells);
+		/** Sets cells to TileA Operation TileB. Tile may be one of sources. */
+		void SetCellsCombined(FGridTile const & TileA, FGridTile const & TileB, EUEGridLayerOperation const Operation, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask);
+		uint32 CountCells(uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const;
+		/** Returns masked word with bits set for cells with bValue state. Word is read with relaxed atomic load. */
+		WordType GetCellsWord(uint32 const WordIndex, WordType const Mask, bool const bValue) const;
+		void SetCellsWord(uint32 const WordIndex, WordType const Word);
+		void Serialize(FArchive & Ar);
 
 		static FUintPoint GetSize();
 		static uint32 GetXSize();
 		static uint32 GetYSize();
 
 	private:
-		void CheckRange(FUintPoint const Coords) const;
-
 		WordType GridCells[NumWordsPerTile];
 	};
 
+	/**
+	 * One bit per tile, indexed by tile index. Used to keep track of tiles with all cells in the same state,
+	 * so that queries can resolve them without touching tile data.
+	 */
+	class FTileSummary
+	{
+	public:
+		void Init(uint32 const TilesNum, bool const bValue);
+		bool Get(uint32 const TileIndex) const;
+		void Set(uint32 const TileIndex, bool const bValue);
+		void SetRange(uint32 const FromTileIndex, uint32 const TilesNum, bool const bValue);
+		bool AreAllSet(uint32 const FromTileIndex, uint32 const TilesNum) const;
+		SIZE_T GetAllocatedSize() const;
+		/** Sets error on archive if loaded summary doesn't match TilesNum. */
+		void Serialize(FArchive & Ar, uint32 const TilesNum);
+
+	private:
+		using SummaryWordType = uint64;
+		static constexpr uint32 NumBitsPerSummaryWord = sizeof(SummaryWordType) * 8;
+
+		TArray<SummaryWordType> SummaryData;
+	};
+
+	/**
+	 * Part of a rectangle lying in a row of TilesNum adjacent tiles starting from TileCoords:
+	 * words [FromWordIndex, ToWordIndex) of each tile masked by Mask.
+	 */
+	struct FTileSpan
+	{
+		FUintPoint TileCoords;
+		uint32 TilesNum;
+		uint32 FromWordIndex;
+		uint32 ToWordIndex;
+		WordType Mask;
+
+		bool CoversWholeTiles() const;
+	};
+
+	/**
+	 * Calls Visitor for each tile span of Rect, row of tiles by row of tiles. Tiles of a row which are covered
+	 * by Rect along X are passed as a single span. Stops if Visitor returns false.
+	 * @return false if visiting was stopped by Visitor.
+	 */
+	template <typename VisitorType>
+	bool VisitTileSpans(FUintRect const & Rect, VisitorType && Visitor) const;
+	/**
+	 * Same as VisitTileSpans, but visits tiles in order of their memory. Tiles of Morton order are passed one by one.
+	 * For queries, which don't depend on order of tiles.
+	 */
+	template <typename VisitorType>
+	bool VisitTileSpansInMemoryOrder(FUintRect const & Rect, VisitorType && Visitor) const;
+	/**
+	 * Calls Visitor for coordinates of each tile of TilesRect lying in aligned block of BlockSize x BlockSize tiles at BlockOrigin,
+	 * in Morton order of quadrants. Stops if Visitor returns false.
+	 * @return false if visiting was stopped by Visitor.
+	 */
+	template <typename VisitorType>
+	bool VisitTilesInMortonOrder(FUintRect const & TilesRect, FUintPoint const BlockOrigin, uint32 const BlockSize, VisitorType & Visitor) const;
+	/** Returns size of aligned block covering all tiles in Morton order. */
+	uint32 GetMortonBlockSize() const;
+
+	/** Sets a part of tile to bValue, skipping tiles whose part is already in this state. */
+	void SetTileCells(uint32 const TileIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue);
+	/** Checks if SourceA Operation SourceB is the same for all cells of tile by tile summaries. */
+	static bool GetUniformCombination(TUEGridLayer const & SourceA, TUEGridLayer const & SourceB, EUEGridLayerOperation const Operation, uint32 const TileIndex, bool & bOutValue);
+	/** Checks a part of tile for a cell with bValue, using tile summaries when possible. */
+	bool TileContains(uint32 const TileIndex, uint32 const FromWordIndex, uint32 const ToWordIndex, WordType const Mask, bool const bValue) const;
+	/** Recalculates summaries of a tile after its change. Doesn't mark tile changed, see MarkTileChanged. */
+	void UpdateTileSummaries(uint32 const TileIndex);
+	/** Records change of a tile with next generation. */
+	void MarkTileChanged(uint32 const TileIndex);
+	/** Appends change to log of exclusive layer. Generation must not be less than generations already in log. */
+	void LogTileChange(uint32 const TileIndex, uint64 const Generation);
+	/** Appends indices of tiles changed after SinceGeneration, each tile once. Tiles of exclusive layer go in order of their changes. */
+	void GetChangedTiles(uint64 const SinceGeneration, TArray<uint32> & OutTileIndices) const;
+
+	/**
+	 * Cells, one bit per cell, e.g. anchors of free rectangles. Stored in rows of ColumnsNum words, word per X coordinate.
+	 * Row RowIndex covers NumBitsPerWord Y coordinates starting from Origin.Y + RowIndex * NumBitsPerWord.
+	 */
+	struct FRowsMask
+	{
+		FUintPoint Origin;
+		uint32 ColumnsNum;
+		uint32 RowsNum;
+		TArray<WordType> Words;
+	};
+
+	static void FindFreeRectsMask(TConstArrayView<TUEGridLayer const *> const Layers, FUintRect const & Rect, FUintPoint const RectSize, FRowsMask & OutMask);
+	/**
+	 * Sets each bit of mask to And or Or of bits in BoxSize rectangle with minimum corner at it, bits outside of mask being unset.
+	 * Separable: doubling shifts along Y within rows, then doubling shifts of words along X. Every pass doubles box size at most.
+	 */
+	static void ApplyBoxToRowsMask(FRowsMask & Mask, FUintPoint const BoxSize, EUEGridLayerOperation const Operation);
+	void SetCellsToBoxCombination(TUEGridLayer const & Source, FUintPoint const BoxSize, EUEGridLayerOperation const Operation);
+	/** Sets all cells from words of columns, word of X column and Y tile being Words[X * ColumnStride + TileY * RowStride]. */
+	void SetAllCells(WordType const * const Words, uint32 const ColumnStride, uint32 const RowStride);
+
+	/** Makes tile use shared tile of SharedTileSlot, releasing its own slot if any. */
+	void SetSharedTile(uint32 const TileIndex, uint32 const SharedTileSlot);
+
 	FUintPoint GetCoordsInTile(FUintPoint const Coords) const;
+	FGridTile const & GetTile(uint32 const TileIndex) const;
+	/** Returns tile for writing, allocating it if tile is shared. */
+	FGridTile & GetMutableTile(uint32 const TileIndex);
 	FGridTile const & GetTile(FUintPoint const Coords) const;
 	FGridTile & GetTile(FUintPoint const Coords);
 	FGridTile const & GetTileByCellCoords(FUintPoint const Coords) const;
@@ -69,6 +340,62 @@ private:
 	void CheckRange(FUintRect const & Rect) const;
 	void SetSize(FUintPoint const NewSize);
 
+	/** Slots of shared read-only tiles in GridLayerData. */
+	static constexpr uint32 EmptyTileSlot = 0;
+	static constexpr uint32 FullTileSlot = 1;
+	static constexpr uint32 SharedTilesNum = 2;
+
+	/** Slot in GridLayerData of every tile, indexed by tile index. */
+	TArray<uint32> TileSlots;
+	/** Shared tiles followed by tiles allocated for layer. */
 	TArray<FGridTile> GridLayerData;
+	/** Released slots of GridLayerData to be reused by sparse storage. */
+	TArray<uint32> FreeTileSlots;
+	/** Tiles with all cells cleared. */
+	FTileSummary EmptyTiles;
+	/** Tiles with all cells set. */
+	FTileSummary FullTiles;
+
+	struct FTileChange
+	{
+		uint64 Generation;
+		uint32 TileIndex;
+	};
+
+	/** Generation of the latest change of every tile, indexed by tile index. */
+	TArray<uint64> TileGenerations;
+	/** Changes of tiles in ascending order of generations. Changes superseded by later changes of the same tile are dropped as log grows. */
+	TArray<FTileChange> TileChangesLog;
+	/** Generation of the latest resize, which changes all tiles. */
+	uint64 SizeGeneration;
+
+	/** Number of locks of concurrent layer. Tile row TileY is guarded by lock TileY % NumRowLockStripes. */
+	static constexpr uint32 NumRowLockStripes = 64;
+
+	/** Lock of stripe of tile rows. Locks are not state of layer, so copies of layer get their own ones. */
+	struct FRowsLock
+	{
+		FRowsLock() = default;
+		FRowsLock(FRowsLock const &);
+		FRowsLock & operator =(FRowsLock const &);
+
+		FRWLock Lock;
+	};
+
+	/** Locks of stripes of tile rows, only for concurrent layer. */
+	mutable TArray<FRowsLock> RowLocks;
 	FUintPoint Size;
+	EStorage Storage;
+	EAccess Access;
+	ETileOrder TileOrder;
 };
+
+/** Tiles of 16 x 32 cells, 64 bytes to fit in one cache line. */
+using FUEGridLayer = TUEGridLayer<uint32, 16>;
+
+/** Instantiated shapes of tiles. */
+extern template class UNDEADEMPIRE_API TUEGridLayer<uint32, 8>;
+extern template class UNDEADEMPIRE_API TUEGridLayer<uint32, 16>;
+extern template class UNDEADEMPIRE_API TUEGridLayer<uint32, 32>;
+extern template class UNDEADEMPIRE_API TUEGridLayer<uint64, 8>;
+extern template class UNDEADEMPIRE_API TUEGridLayer<uint64, 16>;
@@ -0,0 +1,39 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Uniform coarse lookup table of non-overlapping rectangles, such as rects of grid components. Every index cell keeps indices
+ * of rectangles intersecting it, so lookup of a point checks only a few rectangles of one index cell.
+ */
+class UNDEADEMPIRE_API FUEGridRectsIndex
+{
+public:
+	/** Rebuilds index of Rects, rect being found by its index in Rects. Empty rects are skipped. */
+	void Build(TConstArrayView<FIntRect> const InRects);
+
+	/** Returns index of rect containing Coords or INDEX_NONE. */
+	int32 Find(FIntPoint const Coords) const;
+	/** Appends in ascending order indices of rects intersecting Rect. */
+	void FindIntersecting(FIntRect const & Rect, TArray<int32> & OutIndices) const;
+
+private:
+	/** Upper limit of index cells number per rect, which gives index cell size. */
+	static constexpr int64 MaxIndexCellsPerRectNum = 16;
+	static constexpr int64 MinMaxIndexCellsNum = 1024;
+
+	FIntPoint GetIndexCellCoords(FIntPoint const Coords) const;
+	int32 GetIndexCellIndex(FIntPoint const IndexCellCoords) const;
+
+	TArray<FIntRect> Rects;
+	/** Union of rects, index cells cover it starting from its minimum corner. */
+	FIntRect Bounds;
+	/** Size of index cell is power of two, so that index cell coordinates are got with shifts. */
+	uint32 IndexCellSizeLog2 = 0;
+	FIntPoint IndexCellsNum = FIntPoint::ZeroValue;
+	/** Rects of index cell are RectIndices from IndexCellStarts[IndexCellIndex] to IndexCellStarts[IndexCellIndex + 1]. */
+	TArray<int32> IndexCellStarts;
+	TArray<int32> RectIndices;
+};
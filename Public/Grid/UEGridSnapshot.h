@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Grid/UEGridLayer.h"
+#include "Grid/UEGridRectsIndex.h"
+
+enum class EUEGridLayer : uint8;
+
+/**
+ * Read-only copy of layers of all grid components, taken by UUEGridSystem::GetSnapshot. It doesn't refer to grid components,
+ * so it may be read on any thread while grid keeps changing, e.g. by path search, AI placement or autosave tasks.
+ */
+class UNDEADEMPIRE_API FUEGridSnapshot
+{
+public:
+	/** Returns generation of grid the snapshot was taken at, see UUEGridSystem::GetCurrentGeneration. */
+	uint64 GetGeneration() const;
+
+	bool IsInGrid(FIntPoint const CellCoords) const;
+	bool IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint const CellCoords) const;
+
+	/** Checks if specified rectangle is containing occupied cell. */
+	bool HasOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
+	/** Counts occupied cells in specified rectangle. */
+	int64 CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
+	/** Calls Visitor for each occupied cell in specified rectangle. */
+	void ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const;
+
+private:
+	friend class UUEGridSystem;
+
+	/** Calls Visitor with index of every grid component intersecting Rect and part of Rect in its layers. Stops if Visitor returns false. */
+	bool VisitGridComponents(FIntRect const & Rect, TFunctionRef<bool (int32 const, FUintRect const &)> Visitor) const;
+	FUEGridLayer const & GetLayer(int32 const ComponentIndex, EUEGridLayer const GridLayer) const;
+
+	TArray<FIntRect> GridRects;
+	FUEGridRectsIndex GridRectsIndex;
+	/** Copies of layers of every grid component, indexed by EUEGridLayer. */
+	TArray<TArray<FUEGridLayer>> GridLayers;
+	uint64 Generation = 0;
+	/** Version of set of grid components the snapshot has layers of. */
+	uint32 GridComponentsVersion = 0;
+};
@@ -4,9 +4,12 @@
 
 #include "CoreMinimal.h"
 #include "Grid/UEGridLayer.h"
+#include "Grid/UEGridRectsIndex.h"
 #include "Subsystems/WorldSubsystem.h"
+#include "Tasks/Pipe.h"
 #include "UEGridSystem.generated.h"
 
+class FUEGridSnapshot;
 class UUEGridComponent;
 
 UENUM(BlueprintType)
@@ -20,14 +23,101 @@ enum class EUEGridLayer : uint8
 
 ENUM_RANGE_BY_COUNT(EUEGridLayer, EUEGridLayer::LAYERS_NUM)
 
+/**
+ * Minimum corners of free rectangles of one footprint in both orientations within Area, to check any anchor there in O(1).
+ * Kept up to date by UUEGridSystem::UpdateFreeRectsMap.
+ */
+struct UNDEADEMPIRE_API FUEGridFreeRectsMap
+{
+	/** Checks if Size rectangle with minimum corner at Anchor is free. False if Anchor is outside of Area or Size is not footprint of map. */
+	bool IsFree(FIntPoint const Anchor, FIntPoint const Size) const;
+	/** Returns index of FreeAnchors for Size, footprint of map or footprint rotated by 90 degrees, or INDEX_NONE. */
+	int32 GetOrientationIndex(FIntPoint const Size) const;
+
+	/** Footprint of map, rotated footprint is checked too. */
+	FIntPoint Size = FIntPoint::ZeroValue;
+	TArray<EUEGridLayer> GridLayers;
+	/** Anchors the map is kept for. */
+	FIntRect Area;
+	/** Generation of grid the map was updated to, and broadcast generation and version of set of grid components it was checked at. */
+	uint64 Generation = 0;
+	uint64 BroadcastGeneration = 0;
+	uint32 GridComponentsVersion = 0;
+	/** Bit (Y - Area.Min.Y) * Area.Width() + X - Area.Min.X per anchor, for footprint and for rotated footprint unless it's square. */
+	TStaticArray<TBitArray<>, 2> FreeAnchors;
+};
+
+/** Rectangles containing all cells changed since previous notification, per grid layer. */
+struct UNDEADEMPIRE_API FUEGridChanges
+{
+	TConstArrayView<FIntRect> GetChangedRects(EUEGridLayer const GridLayer) const;
+
+	TStaticArray<TArray<FIntRect>, static_cast<uint8>(EUEGridLayer::LAYERS_NUM)> ChangedRects;
+};
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FUEOnGridChanged, FUEGridChanges const &);
+
+/**
+ * Edit of several grid layers committed at once by UUEGridSystem::CommitEdit. Staging only records operations, so edit is built
+ * without touching grid and aborted by dropping it. Commit checks all requirements before changing any cell, so it never has to roll back.
+ */
+class UNDEADEMPIRE_API FUEGridEdit
+{
+public:
+	/** Stages setting cells state in specified rectangle. */
+	void SetCellsState(EUEGridLayer const GridLayer, FIntRect const & Rect, bool const bIsOccupied);
+	/** Stages setting cells of DestinationGridLayer in specified rectangle to SourceGridLayerA Operation SourceGridLayerB. */
+	void CombineLayers(EUEGridLayer const DestinationGridLayer, EUEGridLayer const SourceGridLayerA, EUEGridLayer const SourceGridLayerB, EUEGridLayerOperation const Operation, FIntRect const & Rect);
+	/** Makes commit fail if specified rectangle of GridLayer has occupied cell before the edit. */
+	void RequireNoOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect);
+
+	bool IsEmpty() const;
+	void Reset();
+
+private:
+	friend class UUEGridSystem;
+
+	struct FStagedOperation
+	{
+		FIntRect Rect;
+		EUEGridLayer DestinationGridLayer{};
+		/** Sources are used if state is not set, i.e. operation is combination of layers. */
+		TOptional<bool> bIsOccupied;
+		EUEGridLayer SourceGridLayerA{};
+		EUEGridLayer SourceGridLayerB{};
+		EUEGridLayerOperation Operation{};
+	};
+
+	struct FRequiredFreeRect
+	{
+		EUEGridLayer GridLayer;
+		FIntRect Rect;
+	};
+
+	TArray<FStagedOperation> StagedOperations;
+	TArray<FRequiredFreeRect> RequiredFreeRects;
+};
+
+/** Layers of streamed out grid component, serialized and compressed on worker thread. */
+struct FUEStreamedOutGridLayers
+{
+	TArray<uint8> CompressedLayers;
+	int32 UncompressedSize = 0;
+};
+
 UCLASS()
-class UNDEADEMPIRE_API UUEGridSystem : public UWorldSubsystem
+class UNDEADEMPIRE_API UUEGridSystem : public UTickableWorldSubsystem
 {
 	GENERATED_BODY()
 	
 public:
 	UUEGridSystem();
 
+	virtual void Initialize(FSubsystemCollectionBase & Collection) override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float const DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
 	void RegisterGridComponent(TObjectPtr<UUEGridComponent> const GridComponent);
 	void UnregisterGridComponent(TObjectPtr<UUEGridComponent> const GridComponent);
 
@@ -44,11 +134,18 @@ public:
 	/** Checks if cell containing point Coords is occupied. */
 	bool IsCellOccupied(EUEGridLayer const GridLayer, FVector2D const Coords) const;
 	bool IsCellOccupied(EUEGridLayer const GridLayer, FIntPoint const CellCoords) const;
+	/** Sets OutIsOccupied to occupation of CellsCoords, bit per cell. Grid component is looked up once per run of cells lying in it. */
+	void IsCellsOccupied(EUEGridLayer const GridLayer, TConstArrayView<FIntPoint> const CellsCoords, TBitArray<> & OutIsOccupied) const;
+	/** Sets OutMask to occupation of cells in specified rectangle, bit (Y - Rect.Min.Y) * Rect.Width() + X - Rect.Min.X per cell. */
+	void ExtractRectMask(EUEGridLayer const GridLayer, FIntRect const & Rect, TBitArray<> & OutMask) const;
 	
 	/** Sets cell containing point Coords state. */
 	bool SetCellState(EUEGridLayer const GridLayer, FVector2D const Coords, bool const bIsOccupied);
 	bool SetCellState(EUEGridLayer const GridLayer, FIntPoint const CellCoords, bool const bIsOccupied);
 
+	/** Checks if cell is blocked for paths placed on PathGridLayer: it is nature obstacle or construction which is not such path. */
+	bool IsCellBlockedForPath(EUEGridLayer const PathGridLayer, FIntPoint const CellCoords) const;
+
 	/** Checks if specified rectangle is containing occupied cell. */
 	bool HasOccupiedCell(EUEGridLayer const GridLayer, FBox2D const & Rect) const;
 	bool HasOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
@@ -57,9 +154,96 @@ public:
 	void SetCellsState(EUEGridLayer const GridLayer, FBox2D const & Rect, bool const bIsOccupied);
 	void SetCellsState(EUEGridLayer const GridLayer, FIntRect const & Rect, bool const bIsOccupied);
 
+	/** Counts occupied cells in specified rectangle. */
+	int64 CountOccupiedCells(EUEGridLayer const GridLayer, FIntRect const & Rect) const;
+
+	/**
+	 * Checks all requirements of Edit, then applies its operations in staging order, grid components being looked up once for all of them.
+	 * Changes are published together by the next BroadcastGridChanges, and snapshots never see a part of them.
+	 * @return false if some requirement is not met, grid is not changed then.
+	 */
+	bool CommitEdit(FUEGridEdit const & Edit);
+
+	/** Calls Visitor for each occupied cell in specified rectangle. Cost depends on number of occupied cells, not on rectangle area. */
+	void ForEachOccupiedCell(EUEGridLayer const GridLayer, FIntRect const & Rect, TFunctionRef<void (FIntPoint const)> Visitor) const;
+
+	/**
+	 * Appends to OutAnchors minimum corners of all Size rectangles inside Rect with no occupied cells in any of GridLayersToCheck,
+	 * e.g. { NatureObstacle, Construction } to place a building. Rectangles crossing borders of grid components are not found.
+	 */
+	void FindFreeRects(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, TArray<FIntPoint> & OutAnchors) const;
+	/**
+	 * Finds minimum corner nearest to DesiredAnchor of Size rectangle inside Rect with no occupied cells in any of GridLayersToCheck.
+	 * @return false if there is no such rectangle.
+	 */
+	bool FindNearestFreeRect(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntRect const & Rect, FIntPoint const Size, FIntPoint const DesiredAnchor, FIntPoint & OutAnchor) const;
+	/** Returns generation to pass to GetChangedRects later, to get changes of grid made after this call. */
+	uint64 GetCurrentGeneration() const;
+	/**
+	 * Appends rectangles containing all cells of GridLayer changed after SinceGeneration in all grid components,
+	 * so that overlays and caches can update only them. Grid components registered later are reported whole.
+	 */
+	void GetChangedRects(EUEGridLayer const GridLayer, uint64 const SinceGeneration, TArray<FIntRect> & OutRects) const;
+	/**
+	 * Broadcasts OnGridChanged with changes made since previous broadcast, if there are any. Called on every tick,
+	 * can be called earlier by code which needs subscribers to be up to date at some point of frame.
+	 * Rects of grid components registered or unregistered meanwhile are reported changed in every layer.
+	 */
+	void BroadcastGridChanges();
+
+	/**
+	 * Returns read-only copy of grid to be read on any thread. Must be called on game thread. Snapshots no longer referenced
+	 * by readers are reused, getting only tiles changed since they were taken, so taking snapshot every frame is cheap.
+	 */
+	TSharedRef<FUEGridSnapshot const, ESPMode::ThreadSafe> GetSnapshot();
+
+	/** Compresses layers of grid component being streamed out on worker thread and keeps them until the component is streamed in. */
+	void StreamOutGridLayers(FIntRect const & GridRect, TArray<FUEGridLayer> && GridLayers);
+	/**
+	 * Decompresses layers kept for GridRect by StreamOutGridLayers on worker thread, then passes them to OnStreamedIn on game thread,
+	 * empty if they cannot be restored. Layers are kept until OnStreamedIn returns true, i.e. takes them.
+	 * @return false if there are no layers kept for GridRect.
+	 */
+	bool StreamInGridLayers(FIntRect const & GridRect, TUniqueFunction<bool (TArray<FUEGridLayer> &&)> && OnStreamedIn);
+
+	/** Fires at most once per BroadcastGridChanges with all changes of grid coalesced, instead of on every cells state change. */
+	FUEOnGridChanged OnGridChanged;
+
+	/**
+	 * Makes Map keep anchors of Size rectangles, in both orientations, with no occupied cells in any of GridLayersToCheck for all anchors of Area.
+	 * Map of other footprint or layers, or not covering Area, is rebuilt for Area grown by Margin. Otherwise only anchors of rectangles
+	 * touching cells changed since the map was updated are checked again. Changes are looked up at most once per BroadcastGridChanges,
+	 * so it may be called on every cursor move, and changes made after the latest broadcast are seen after the next one.
+	 */
+	void UpdateFreeRectsMap(TConstArrayView<EUEGridLayer> const GridLayersToCheck, FIntPoint const Size, FIntRect const & Area, int32 const Margin, FUEGridFreeRectsMap & InOutMap) const;
+
 private:
-	// TODO: in general case here should be spatial tree index.
+	/** Snapshots beyond it are left to their readers. */
+	static constexpr int32 MaxKeptSnapshotsNum = 2;
+
+	/** Returns index of grid component containing cell or INDEX_NONE. */
+	int32 FindGridComponentIndex(FIntPoint const CellCoords) const;
+	/** Sets anchors of Map in AnchorsRect, clipped to its Area, to whether rectangles at them are free now. */
+	void UpdateFreeAnchors(FIntRect const & AnchorsRect, FUEGridFreeRectsMap & Map) const;
+
 	TArray<TObjectPtr<UUEGridComponent>> GridComponents;
 	TArray<FIntRect> GridRects;
+	/** Index of GridRects, rebuilt on registration changes, as cells are looked up far more often than grid components change. */
+	FUEGridRectsIndex GridRectsIndex;
 	float CellSize;
+	/** Generation changes after which are not broadcast yet. */
+	uint64 BroadcastGeneration;
+	/** Changes being broadcast, kept to reuse allocations of rects arrays. */
+	FUEGridChanges GridChanges;
+	/** Changed on every registration change, so that snapshots know their grid components are outdated. */
+	uint32 GridComponentsVersion;
+	/** GridComponentsVersion at previous broadcast. */
+	uint32 BroadcastGridComponentsVersion;
+	/** Rects of grid components registered or unregistered since previous broadcast. */
+	TArray<FIntRect> RegistrationChangedRects;
+	/** Latest snapshots, oldest first, kept to be refreshed instead of copying whole grid. */
+	TArray<TSharedRef<FUEGridSnapshot, ESPMode::ThreadSafe>> Snapshots;
+	/** Serializes streaming of layers, so that layers are decompressed only after they are compressed. */
+	TUniquePtr<UE::Tasks::FPipe> StreamingTaskPipe;
+	TMap<FIntRect, TSharedRef<FUEStreamedOutGridLayers, ESPMode::ThreadSafe>> StreamedOutGridLayers;
 };
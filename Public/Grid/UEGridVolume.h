@@ -22,6 +22,12 @@ public:
 
 	virtual void PreRegisterAllComponents() override;
 
+#if WITH_EDITOR
+	/** Bakes nature obstacle layer of grid, so that it isn't traced on every BeginPlay. Should be called again after landscape changes. */
+	UFUNCTION(CallInEditor, Category = "UE Grid")
+	void BakeNatureObstacleLayer();
+#endif
+
 protected:
 	virtual bool NeedsLoadForServer() const override;
 	virtual bool IsLevelBoundsRelevant() const override;
@@ -23,6 +23,8 @@ public:
 	void UnregisterPath(FIntRect const & Rect) const;
 	TObjectPtr<UUEPathSystem> GetPathSystem() const;
 	bool IsPathAt(FIntPoint const Coords) const;
+	/** Sets OutArePaths to whether there is path at CoordsArray, bit per coords, with one grid query. */
+	void ArePathsAt(TConstArrayView<FIntPoint> const CoordsArray, TBitArray<> & OutArePaths) const;
 	bool ShouldBeVertex(FIntPoint const Coords) const;
 	EUEGridLayer GetPathRelatedGridLayer() const;
 	EUEPathGraph GetPathGraphToRegister() const;